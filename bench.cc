@@ -0,0 +1,697 @@
+/*  Benchmarks for GNU ddrescue
+    Copyright (C) 2015 Antonio Diaz Diaz.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+    Measures the speed of some internal functions of ddrescue, comparing
+    the alternative implementations of each one. Not installed.
+
+    Exit status: 0 for a normal exit, 1 for environmental problems
+    (invalid flags, etc), 3 for an internal consistency error (eg, a
+    benchmarked implementation returned a wrong result).
+*/
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "arg_parser.h"
+#include "block.h"
+#include "zero.h"
+
+
+namespace {
+
+const char * const program_name = "bench_ddrescue";
+const char * invocation_name = 0;
+
+
+void show_help()
+  {
+  std::printf( "Benchmarks for GNU ddrescue.\n"
+               "\nUsage: %s [options] benchmark...\n", invocation_name );
+  std::printf( "\nBenchmarks:\n"
+               "  logfile                        loading of text and binary logfiles\n"
+               "  compact                        peak memory of compacting, splitting and copying maps\n"
+               "  create                         creating a logfile from a list of blocks\n"
+               "  map                            memory used by the map of sblocks\n"
+               "  zero                           zero-block detection (block_is_zero)\n"
+               "\nOptions:\n"
+               "  -h, --help                     display this help and exit\n"
+               "  -l, --lines=<n>                lines of synthetic logfile or map [10M]\n"
+               "  -s, --size=<bytes>             size of data per call [512,64Ki,1Mi]\n"
+               "  -t, --time=<seconds>           minimum time to run each test [1]\n"
+               "Numbers may be followed by a multiplier: k = 1000, Ki = 1024, M = 10^6,\n"
+               "Mi = 2^20, G = 10^9, Gi = 2^30.\n" );
+  }
+
+
+long long getnum( const char * const arg, const long long min,
+                  const long long max )
+  {
+  char * tail;
+  errno = 0;
+  long long result = std::strtoll( arg, &tail, 0 );
+  if( tail == arg || errno )
+    { show_error( "Bad or missing numerical argument.", 0, true );
+      std::exit( 1 ); }
+  const int factor = ( tail[0] && tail[1] == 'i' ) ? 1024 : 1000;
+  int exponent = 0;
+  switch( tail[0] )
+    {
+    case 0  : break;
+    case 'G': exponent = 3; break;
+    case 'M': exponent = 2; break;
+    case 'K': if( factor == 1024 ) { exponent = 1; break; }	// fall through
+    case 'k': if( factor == 1000 ) { exponent = 1; break; }	// fall through
+    default : show_error( "Bad multiplier in numerical argument.", 0, true );
+              std::exit( 1 );
+    }
+  for( int i = 0; i < exponent && result <= max; ++i ) result *= factor;
+  if( result < min || result > max )
+    { show_error( "Numerical argument out of limits." ); std::exit( 1 ); }
+  return result;
+  }
+
+
+double now()
+  {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+  }
+
+
+// Allocate 'size' bytes aligned to 4096, plus 'extra' bytes.
+//
+uint8_t * aligned_buffer( std::vector< uint8_t > & v, const int size,
+                          const int extra = 0 )
+  {
+  v.assign( size + extra + 4096, 0 );
+  uint8_t * p = &v[0];
+  const int disp = reinterpret_cast<long> (p) % 4096;
+  if( disp ) p += 4096 - disp;
+  return p;
+  }
+
+
+void check_zero_test( const Zero_test & t, uint8_t * const buf,
+                      const int size )
+  {
+  const int positions[] = { 0, 1, 15, 16, 31, 63, 64, 127, 128, 511 };
+  bool ok = t.function( buf, size );
+  for( int s = 0; ok && s <= std::min( size, 300 ); ++s )
+    for( int offset = 0; ok && offset < 8; ++offset )	// unaligned sizes
+      {
+      if( !t.function( buf + offset, s ) ) ok = false;
+      if( s > 0 )
+        { buf[offset+s-1] = 1;
+          if( t.function( buf + offset, s ) ) ok = false;
+          buf[offset+s-1] = 0; }
+      }
+  for( unsigned i = 0; ok && i < sizeof positions / sizeof *positions; ++i )
+    {
+    const int pos = ( positions[i] < size ) ? positions[i] : size - 1;
+    buf[pos] = 0x80;
+    if( t.function( buf, size ) ) ok = false;
+    buf[pos] = 0;
+    buf[size-1-pos] = 1;
+    if( t.function( buf, size ) ) ok = false;
+    buf[size-1-pos] = 0;
+    }
+  if( !ok )
+    {
+    std::string msg( "implementation '" ); msg += t.name;
+    msg += "' of block_is_zero gives wrong results.";
+    internal_error( msg.c_str() );
+    }
+  }
+
+
+// Times 'block_is_zero' implementations on blocks of zeros (the worst
+// case, as a nonzero byte ends the test early).
+//
+void bench_zero( const std::vector< int > & sizes, const double min_time )
+  {
+  const Zero_test * const tests = zero_tests();
+  std::printf( "block_is_zero, all-zero blocks (MB/s, speedup over 'bytes')\n" );
+  std::printf( "%10s", "size" );
+  for( int i = 0; tests[i].name; ++i ) std::printf( " %14s", tests[i].name );
+  std::fputc( '\n', stdout );
+  for( unsigned j = 0; j < sizes.size(); ++j )
+    {
+    const int size = sizes[j];
+    std::vector< uint8_t > v;
+    uint8_t * const buf = aligned_buffer( v, size, 8 );
+    std::printf( "%10d", size );
+    double base_rate = 0;
+    for( int i = 0; tests[i].name; ++i )
+      {
+      check_zero_test( tests[i], buf, size );
+      long long calls = 0, zero_calls = 0;
+      const double t0 = now();
+      double t1 = t0;
+      for( long long n = 1; t1 - t0 < min_time; n *= 2 )
+        {
+        for( long long k = 0; k < n; ++k )
+          if( tests[i].function( buf, size ) ) ++zero_calls;
+        calls += n;
+        t1 = now();
+        }
+      if( zero_calls != calls ) internal_error( "block_is_zero failed." );
+      const double rate = ( (double)calls * size ) / ( t1 - t0 ) / 1e6;
+      if( i == 0 ) base_rate = rate;
+      std::printf( " %9.0f %4.1fx", rate, rate / base_rate );
+      }
+    std::fputc( '\n', stdout );
+    }
+  int last = 0;
+  while( tests[last+1].name ) ++last;
+  std::printf( "block_is_zero uses '%s'.\n", tests[last].name );
+  }
+
+
+// The logfile parser of ddrescue 1.19; fgetc and sscanf per line.
+// Returns the number of blocks read, or -1 if error.
+//
+long long load_sscanf( const char * const name )
+  {
+  FILE * const f = std::fopen( name, "r" );
+  if( !f ) return -1;
+  std::vector< Sblock > v;
+  char buf[128];
+  long long pos, size, retval = 0;
+  char ch;
+  bool status_line = true;
+  while( retval >= 0 )
+    {
+    int c, len = 0;
+    do { c = std::fgetc( f );
+         if( c == '#' ) do c = std::fgetc( f ); while( c != '\n' && c != EOF ); }
+    while( std::isspace( c ) );
+    if( c == EOF ) break;
+    while( c != EOF && c != '\n' )
+      { if( len < 127 ) buf[len++] = c;
+        c = std::fgetc( f );
+        if( c == '#' ) do c = std::fgetc( f ); while( c != '\n' && c != EOF ); }
+    buf[len] = 0;
+    if( status_line )
+      { if( std::sscanf( buf, "%lli %c\n", &pos, &ch ) != 2 ) retval = -1;
+        status_line = false; }
+    else if( std::sscanf( buf, "%lli %lli %c\n", &pos, &size, &ch ) == 3 &&
+             Sblock::isstatus( ch ) )
+      v.push_back( Sblock( pos, size, Sblock::Status( ch ) ) );
+    else retval = -1;
+    }
+  std::fclose( f );
+  return ( retval < 0 ) ? retval : (long long)v.size();
+  }
+
+
+long long load_logfile( const char * const name )
+  {
+  Logfile logfile( name );
+  if( !logfile.read_logfile() ) return -1;
+  return logfile.sblocks();
+  }
+
+
+// Writes a synthetic logfile of 'lines' blocks with statuses like those
+// of a drive with many errors, and times loading it with each parser.
+//
+void bench_logfile( const long long lines )
+  {
+  const char * const tmpdir = std::getenv( "TMPDIR" );
+  const std::string dir( ( tmpdir && tmpdir[0] ) ? tmpdir : "/tmp" );
+  const std::string text_name( dir + "/bench_logfile.txt" );
+  const std::string binary_name( dir + "/bench_logfile.bin" );
+  FILE * f = std::fopen( text_name.c_str(), "w" );
+  if( !f ) { show_error( "Can't create temporary logfile", errno ); std::exit( 1 ); }
+  const char status[] = "+-+/+*+?";
+  std::fprintf( f, "# Rescue Logfile. Created by %s\n0x00000000     ?\n",
+                program_name );
+  for( long long i = 0, pos = 0; i < lines; ++i )
+    {
+    const long long size = ( i & 1 ) ? 512 : 4096 * ( 1 + i % 37 );
+    std::fprintf( f, "0x%08llX  0x%08llX  %c\n", pos, size, status[i%8] );
+    pos += size;
+    }
+  if( std::fclose( f ) != 0 )
+    { show_error( "Error writing temporary logfile", errno ); std::exit( 1 ); }
+  {
+  Logfile logfile( text_name.c_str() );
+  logfile.read_logfile();
+  logfile.binary( true );
+  f = std::fopen( binary_name.c_str(), "w" );
+  if( !f || !logfile.write_logfile( f ) || std::fclose( f ) != 0 )
+    { show_error( "Error writing temporary logfile", errno ); std::exit( 1 ); }
+  }
+
+  struct Test { const char * name; const char * file;
+                long long (*function)( const char * ); };
+  const Test tests[] =
+    { { "sscanf", text_name.c_str(), load_sscanf },
+      { "text", text_name.c_str(), load_logfile },
+      { "binary", binary_name.c_str(), load_logfile } };
+  std::printf( "Loading a logfile of %lld blocks (s, Mlines/s, speedup over 'sscanf')\n",
+               lines );
+  double base_time = 0;
+  for( unsigned i = 0; i < sizeof tests / sizeof *tests; ++i )
+    {
+    const double t0 = now();
+    const long long blocks = tests[i].function( tests[i].file );
+    const double t = now() - t0;
+    if( blocks != lines )
+      {
+      std::string msg( "parser '" ); msg += tests[i].name;
+      msg += "' read a wrong number of blocks.";
+      internal_error( msg.c_str() );
+      }
+    if( i == 0 ) base_time = t;
+    std::printf( "%10s %8.3f %8.2f %5.1fx\n", tests[i].name, t,
+                 lines / t / 1e6, base_time / t );
+    }
+  std::remove( text_name.c_str() );
+  std::remove( binary_name.c_str() );
+  }
+
+
+long max_rss_kib()
+  {
+  struct rusage ru;
+  if( getrusage( RUSAGE_SELF, &ru ) != 0 ) return 0;
+#ifdef __APPLE__
+  return ru.ru_maxrss / 1024;
+#else
+  return ru.ru_maxrss;
+#endif
+  }
+
+
+void build_vector( const long long blocks )
+  {
+  std::vector< Sblock > v;
+  v.reserve( blocks );
+  for( long long i = 0, pos = 0; i < blocks; ++i, pos += 4096 )
+    v.push_back( Sblock( pos, 4096, ( i & 1 ) ? Sblock::finished :
+                                                Sblock::bad_sector ) );
+  if( (long long)v.size() != blocks ) internal_error( "wrong map size." );
+  }
+
+
+// As done by read_logfile.
+void build_appended( const long long blocks )
+  {
+  Sblock_map m;
+  for( long long i = 0, pos = 0; i < blocks; ++i, pos += 4096 )
+    m.push_back( Sblock( pos, 4096, ( i & 1 ) ? Sblock::finished :
+                                                Sblock::bad_sector ) );
+  if( (long long)m.size() != blocks ) internal_error( "wrong map size." );
+  }
+
+
+// As done by read_logfile with '--max-map-memory=1Mi'.
+void build_paged( const long long blocks )
+  {
+  Sblock_map m;
+  m.limit_memory( 1 << 20, 0 );
+  for( long long i = 0, pos = 0; i < blocks; ++i, pos += 4096 )
+    m.push_back( Sblock( pos, 4096, ( i & 1 ) ? Sblock::finished :
+                                                Sblock::bad_sector ) );
+  if( (long long)m.size() != blocks ) internal_error( "wrong map size." );
+  }
+
+
+// As done by a rescue; splitting a single block at random places.
+void build_split( const long long blocks )
+  {
+  Sblock_map m;
+  m.push_back( Sblock( 0, blocks * 4096, Sblock::non_tried ) );
+  unsigned long long seed = 1;
+  while( (long long)m.size() < blocks )
+    {
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    const long long pos = ( seed >> 11 ) % ( blocks * 4096 );
+    const int i = m.find( pos );
+    if( m.pos( i ) == pos ) continue;
+    m.split( i, pos );
+    m.status( i + 1, ( seed & 1 ) ? Sblock::finished : Sblock::bad_sector );
+    }
+  }
+
+
+void wait_child( const pid_t pid )
+  {
+  int status;
+  if( waitpid( pid, &status, 0 ) != pid || !WIFEXITED( status ) ||
+      WEXITSTATUS( status ) != 0 )
+    { show_error( "Child process failed." ); std::exit( 1 ); }
+  }
+
+
+// Builds maps of 'blocks' sblocks in several ways and shows the memory
+// used by each one. Each map is built by a child process, so that the
+// increase of its resident set size can be measured.
+//
+void bench_map( const long long blocks )
+  {
+  struct Test { const char * name; void (*function)( const long long ); };
+  const Test tests[] =
+    { { "vector", build_vector },		// std::vector< Sblock >
+      { "appended", build_appended },
+      { "paged", build_paged },
+      { "split", build_split } };
+  std::printf( "Memory used by a map of %lld sblocks (MB, bytes per sblock, s)\n",
+               blocks );
+  for( unsigned i = 0; i < sizeof tests / sizeof *tests; ++i )
+    {
+    std::fflush( stdout );
+    const pid_t pid = fork();
+    if( pid < 0 ) { show_error( "Can't fork", errno ); std::exit( 1 ); }
+    if( pid == 0 )				// child
+      {
+      const long rss0 = max_rss_kib();
+      const double t0 = now();
+      tests[i].function( blocks );
+      const double t = now() - t0;
+      const double bytes = ( max_rss_kib() - rss0 ) * 1024.0;
+      std::printf( "%10s %8.1f %8.1f %8.3f\n", tests[i].name, bytes / 1e6,
+                   bytes / blocks, t );
+      std::fflush( stdout );
+      _exit( 0 );
+      }
+    wait_child( pid );
+    }
+  }
+
+
+// As done by compact_sblock_vector before 1.20; copy the joined sblocks
+// to a new map and swap it in.
+void compact_copy( Sblock_map & m, const Sblock_map & )
+  {
+  Sblock_map new_map;
+  unsigned l = 0;
+  while( l < m.size() )
+    {
+    const Sblock::Status st = m.status( l );
+    unsigned r = l + 1;
+    while( r < m.size() && m.status( r ) == st ) ++r;
+    const long long pos = m.pos( l );
+    new_map.push_back( Sblock( pos, m.end( r - 1 ) - pos, st ) );
+    l = r;
+    }
+  m.swap( new_map );
+  }
+
+
+void compact_in_place( Sblock_map & m, const Sblock_map & ) { m.compact(); }
+
+
+// As done by split_by_logfile_borders before 1.20.
+void split_copy( Sblock_map & m, const Sblock_map & b )
+  {
+  Sblock_map new_map;
+  unsigned j = 0;
+  for( unsigned i = 0; i < m.size(); ++i )
+    {
+    Sblock sb = m[i];
+    while( j < b.size() )
+      {
+      while( j < b.size() && b[j] < sb ) ++j;
+      if( j >= b.size() ) break;
+      const Sblock db = b[j];
+      if( sb.strictly_includes( db.pos() ) )
+        new_map.push_back( sb.split( db.pos() ) );
+      if( sb.strictly_includes( db.end() ) )
+        new_map.push_back( sb.split( db.end() ) );
+      if( sb.pos() < db.end() ) break;
+      }
+    new_map.push_back( sb );
+    }
+  m.swap( new_map );
+  }
+
+
+void split_in_place( Sblock_map & m, const Sblock_map & b )
+  { m.split_by( b ); }
+
+
+// As done by each snapshot of the logfile with '--async-logfile' or
+// '--threads'.
+void copy_map( Sblock_map & m, const Sblock_map & )
+  {
+  Sblock_map c( m );
+  if( c.size() != m.size() ) internal_error( "wrong map size." );
+  }
+
+
+// Compacts a map of 'blocks' sblocks, and splits it by the borders of a
+// map of 'blocks' / 2 sblocks, both by copying to a new map and in place,
+// and copies it whole.
+// Shows the increase of the peak resident set size, and the time taken.
+//
+void bench_compact( const long long blocks )
+  {
+  struct Test
+    { const char * name;
+      void (*function)( Sblock_map & m, const Sblock_map & b ); };
+  const Test tests[] =
+    { { "compact copy", compact_copy },
+      { "compact", compact_in_place },
+      { "split copy", split_copy },
+      { "split", split_in_place },
+      { "copy", copy_map } };
+  std::printf( "Peak memory and time of operations on a map of %lld sblocks "
+               "(MB, s)\n", blocks );
+  for( unsigned i = 0; i < sizeof tests / sizeof *tests; ++i )
+    {
+    std::fflush( stdout );
+    const pid_t pid = fork();
+    if( pid < 0 ) { show_error( "Can't fork", errno ); std::exit( 1 ); }
+    if( pid == 0 )				// child
+      {
+      Sblock_map m, b;			// runs of 1 or 2 sblocks per status
+      for( long long i = 0, pos = 0; i < blocks; ++i, pos += 4096 )
+        m.push_back( Sblock( pos, 4096, ( i % 3 ) ? Sblock::finished :
+                                                    Sblock::bad_sector ) );
+      for( long long i = 0, pos = 2048; i < blocks / 2; ++i, pos += 8192 )
+        b.push_back( Sblock( pos, 8192, Sblock::finished ) );
+      const long rss0 = max_rss_kib();
+      const double t0 = now();
+      tests[i].function( m, b );
+      const double t = now() - t0;
+      const double bytes = ( max_rss_kib() - rss0 ) * 1024.0;
+      std::printf( "%12s %8.1f %8.3f   %u sblocks\n", tests[i].name,
+                   bytes / 1e6, t, m.size() );
+      std::fflush( stdout );
+      _exit( 0 );
+      }
+    wait_child( pid );
+    }
+  }
+
+
+// As done by create_logfile before 1.20; mark each listed block in turn.
+int create_by_chunks( std::vector< long long > & blocks, const Domain & domain )
+  {
+  Logfile logfile( 0 );
+  logfile.make_blank();
+  logfile.split_by_domain_borders( domain );
+  for( int i = 0; i < logfile.sblocks(); ++i )
+    logfile.change_sblock_status( i, Sblock::bad_sector );
+  int dcursor = 0;
+  for( unsigned i = 0; i < blocks.size(); ++i )
+    {
+    const Block b( blocks[i] * 512, 512 );
+    if( domain.includes( b, dcursor ) )
+      logfile.change_chunk_status( b, Sblock::finished, domain );
+    }
+  logfile.truncate_vector( domain.end(), true );
+  return logfile.sblocks();
+  }
+
+
+int create_bulk( std::vector< long long > & blocks, const Domain & domain )
+  {
+  Logfile logfile( 0 );
+  logfile.make_from_list( blocks, 512, domain, Sblock::finished,
+                          Sblock::bad_sector );
+  return logfile.sblocks();
+  }
+
+
+// Creates a logfile from a list of 'lines' block numbers, like those
+// printed by badblocks for a drive with many errors, given in ascending
+// and in random order.
+//
+void bench_create( const long long lines )
+  {
+  std::vector< long long > sorted;
+  unsigned long long seed = 1;
+  for( long long block = 0; (long long)sorted.size() < lines; )
+    {
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    block += 1 + ( seed >> 33 ) % 64;		// gap before next run
+    for( int n = 1 + ( seed >> 20 ) % 8;
+         n > 0 && (long long)sorted.size() < lines; --n )
+      sorted.push_back( block++ );
+    }
+  std::vector< long long > shuffled( sorted );
+  for( long long i = lines - 1; i > 0; --i )
+    {
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    std::swap( shuffled[i], shuffled[( seed >> 11 ) % ( i + 1 )] );
+    }
+  const Domain domain( 0, -1 );
+
+  struct Test
+    { const char * name; const std::vector< long long > * blocks;
+      int (*function)( std::vector< long long > &, const Domain & ); };
+  const Test tests[] =
+    { { "chunks sorted", &sorted, create_by_chunks },
+      { "bulk sorted", &sorted, create_bulk },
+      { "chunks random", &shuffled, create_by_chunks },
+      { "bulk random", &shuffled, create_bulk } };
+  std::printf( "Creating a logfile from %lld block numbers (s, Mblocks/s)\n",
+               lines );
+  int sblocks = -1;
+  for( unsigned i = 0; i < sizeof tests / sizeof *tests; ++i )
+    {
+    std::vector< long long > blocks( *tests[i].blocks );
+    const double t0 = now();
+    const int n = tests[i].function( blocks, domain );
+    const double t = now() - t0;
+    if( sblocks < 0 ) sblocks = n;
+    else if( n != sblocks )
+      {
+      std::string msg( "method '" ); msg += tests[i].name;
+      msg += "' created a wrong number of sblocks.";
+      internal_error( msg.c_str() );
+      }
+    std::printf( "%14s %8.3f %8.2f\n", tests[i].name, t, lines / t / 1e6 );
+    std::fflush( stdout );
+    }
+  }
+
+} // end namespace
+
+
+int verbosity = 0;
+
+
+bool write_logfile_header( FILE * const f, const char * const logtype )
+  {
+  return ( std::fprintf( f, "# %s Logfile. Created by %s\n",
+                         logtype, program_name ) >= 0 );
+  }
+
+
+bool write_timestamp( FILE * const ) { return true; }
+
+
+void show_error( const char * const msg, const int errcode, const bool help )
+  {
+  if( verbosity >= 0 )
+    {
+    if( msg && msg[0] )
+      {
+      std::fprintf( stderr, "%s: %s", program_name, msg );
+      if( errcode > 0 )
+        std::fprintf( stderr, ": %s", std::strerror( errcode ) );
+      std::fprintf( stderr, "\n" );
+      }
+    if( help )
+      std::fprintf( stderr, "Try '%s --help' for more information.\n",
+                    invocation_name );
+    }
+  }
+
+
+void internal_error( const char * const msg )
+  {
+  if( verbosity >= 0 )
+    std::fprintf( stderr, "%s: internal error: %s\n", program_name, msg );
+  std::exit( 3 );
+  }
+
+
+int main( const int argc, const char * const argv[] )
+  {
+  std::vector< int > sizes;
+  long long lines = 10000000;
+  double min_time = 1;
+  invocation_name = argv[0];
+
+  const Arg_parser::Option options[] =
+    {
+    { 'h', "help",                Arg_parser::no  },
+    { 'l', "lines",               Arg_parser::yes },
+    { 's', "size",                Arg_parser::yes },
+    { 't', "time",                Arg_parser::yes },
+    {  0 , 0,                     Arg_parser::no  } };
+
+  const Arg_parser parser( argc, argv, options );
+  if( parser.error().size() )				// bad option
+    { show_error( parser.error().c_str(), 0, true ); return 1; }
+
+  int argind = 0;
+  for( ; argind < parser.arguments(); ++argind )
+    {
+    const int code = parser.code( argind );
+    if( !code ) break;					// no more options
+    const char * const arg = parser.argument( argind ).c_str();
+    switch( code )
+      {
+      case 'h': show_help(); return 0;
+      case 'l': lines = getnum( arg, 1, 1000000000 ); break;
+      case 's': sizes.push_back( getnum( arg, 1, 1 << 30 ) ); break;
+      case 't': min_time = getnum( arg, 1, 3600 ); break;
+      default : internal_error( "uncaught option." );
+      }
+    } // end process options
+
+  if( argind >= parser.arguments() )
+    { show_error( "No benchmark specified.", 0, true ); return 1; }
+  if( sizes.empty() )
+    { sizes.push_back( 512 ); sizes.push_back( 65536 );
+      sizes.push_back( 1 << 20 ); }
+
+  for( ; argind < parser.arguments(); ++argind )
+    {
+    const std::string & name = parser.argument( argind );
+    if( name == "compact" ) bench_compact( lines );
+    else if( name == "create" ) bench_create( lines );
+    else if( name == "logfile" ) bench_logfile( lines );
+    else if( name == "map" ) bench_map( lines );
+    else if( name == "zero" ) bench_zero( sizes, min_time );
+    else
+      {
+      std::string msg( "Unknown benchmark '" ); msg += name; msg += "'.";
+      show_error( msg.c_str(), 0, true ); return 1;
+      }
+    }
+  return 0;
+  }
@@ -18,12 +18,15 @@
 #define _FILE_OFFSET_BITS 64
 
 #include <algorithm>
+#include <cerrno>
 #include <climits>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <string>
 #include <vector>
 #include <stdint.h>
+#include <unistd.h>
 
 #include "block.h"
 
@@ -98,7 +101,8 @@ Domain::Domain( const long long p, const long long s,
                 const char * const logname, const bool loose )
   {
   const Block b( p, s );
-  if( !logname || !logname[0] ) { block_vector.push_back( b ); return; }
+  if( !logname || !logname[0] )
+    { block_vector.push_back( b ); update_in_size(); return; }
   Logfile logfile( logname );
   if( !logfile.read_logfile( loose ? '?' : 0 ) )
     {
@@ -114,25 +118,947 @@ Domain::Domain( const long long p, const long long s,
     const Sblock & sb = logfile.sblock( i );
     if( sb.status() == Sblock::finished ) block_vector.push_back( sb );
     }
-  if( block_vector.empty() ) block_vector.push_back( Block( 0, 0 ) );
+  if( block_vector.empty() ) clear();
   else this->crop( b );
   }
 
 
+void Domain::update_in_size()
+  {
+  in_size_ = 0;
+  for( unsigned i = 0; i < block_vector.size(); ++i )
+    in_size_ += block_vector[i].size();
+  }
+
+
+// Returns the index of the first block ending after 'pos', or blocks()
+// if there is none.
+//
+int Domain::find( const long long pos ) const
+  {
+  int l = 0, r = blocks();
+  while( l < r )
+    {
+    const int m = l + ( r - l ) / 2;
+    if( block_vector[m].end() <= pos ) l = m + 1; else r = m;
+    }
+  return l;
+  }
+
+
+// Same as above, but walks from the block found by the last call using
+// 'cursor', so that looking up increasing (or decreasing) positions takes
+// amortized O(1) time. Falls back to a binary search for distant positions.
+// 'cursor' must be initialized to 0.
+//
+int Domain::find( const long long pos, int & cursor ) const
+  {
+  const int near = 8;
+  int i = std::min( std::max( cursor, 0 ), blocks() );
+  while( i < blocks() && block_vector[i].end() <= pos && i - cursor < near )
+    ++i;
+  while( i > 0 && block_vector[i-1].end() > pos && cursor - i < near ) --i;
+  if( ( i < blocks() && block_vector[i].end() <= pos ) ||
+      ( i > 0 && block_vector[i-1].end() > pos ) )
+    i = find( pos );
+  cursor = i;
+  return i;
+  }
+
+
 void Domain::crop( const Block & b )
   {
   unsigned r = block_vector.size();
   while( r > 0 && b < block_vector[r-1] ) --r;
   if( r > 0 ) block_vector[r-1].crop( b );
   if( r <= 0 || block_vector[r-1].size() <= 0 )	// no block overlaps b
-    { block_vector.clear(); block_vector.push_back( Block( 0, 0 ) ); return; }
+    { clear(); return; }
   if( r < block_vector.size() )			// remove blocks beyond b
     block_vector.erase( block_vector.begin() + r, block_vector.end() );
-  if( b.pos() <= 0 ) return;
+  if( b.pos() <= 0 ) { update_in_size(); return; }
   --r;		// block_vector[r] is now the last non-cropped-out block
   unsigned l = 0;
   while( l < r && block_vector[l] < b ) ++l;
   if( l < r ) block_vector[l].crop( b );	// crop block overlapping b
   if( l > 0 )					// remove blocks before b
     block_vector.erase( block_vector.begin(), block_vector.begin() + l );
+  update_in_size();
+  }
+
+
+int Sblock_map::Node::count() const
+  {
+  if( leaf ) return n;
+  int c = 0;
+  for( unsigned k = 0; k < counts.size(); ++k ) c += counts[k];
+  return c;
+  }
+
+
+int Sblock_map::Node::compute_mask() const
+  {
+  int m = 0;
+  if( leaf )
+    for( int i = 0; i < n; ++i ) m |= status_bit( Sblock::Status( st[i] ) );
+  else
+    for( unsigned k = 0; k < children.size(); ++k )
+      m |= children[k]->mask;
+  return m;
+  }
+
+
+// Recompute the masks of this node and of its ancestors.
+//
+void Sblock_map::Node::update_mask()
+  {
+  for( Node * n = this; n; n = n->parent )
+    {
+    const int m = n->compute_mask();
+    if( m == n->mask ) break;
+    n->mask = m;
+    }
+  }
+
+
+// Keeps at most 'max_resident' leaves in memory. The rest of the leaves
+// are written to an unlinked temporary file, and read back when accessed.
+// Internal nodes and the headers of the leaves (with the masks and the
+// first position of each leaf) are always kept in memory, so that the
+// searches only read the leaves they stop at.
+//
+struct Sblock_map::Pager
+  {
+  enum { slot_size = leaf_words * sizeof (long long) };
+  std::vector< Node * > resident;	// leaves in memory
+  std::vector< int > free_slots;	// slots of deleted leaves
+  std::string name;			// swap file is created as name.swapXXXXXX
+  long long max_memory;
+  int max_resident;
+  int slots;				// slots used in swap file
+  int fd;				// swap file, or -1 if not yet created
+  unsigned hand;			// next leaf to consider for eviction
+
+  Pager( const long long bytes, const std::string & swap_name )
+    : name( swap_name ), max_memory( bytes ),
+      max_resident( std::max( 4LL, std::min( bytes / slot_size,
+                                             (long long)INT_MAX ) ) ),
+      slots( 0 ), fd( -1 ), hand( 0 ) {}
+  ~Pager() { if( fd >= 0 ) close( fd ); }
+
+  void add( Node * const n )
+    { n->ring = resident.size(); resident.push_back( n ); }
+  void remove( Node * const n )
+    {
+    Node * const l = resident.back();
+    resident[n->ring] = l; l->ring = n->ring;
+    resident.pop_back(); n->ring = -1;
+    }
+  int new_slot();
+  void io( const bool write, Node * const n );
+  };
+
+
+int Sblock_map::Pager::new_slot()
+  {
+  if( free_slots.size() )
+    { const int s = free_slots.back(); free_slots.pop_back(); return s; }
+  if( fd < 0 )
+    {
+    std::string tmp( ( name.size() ? name : "/tmp/ddrescue" ) + ".swapXXXXXX" );
+    std::vector< char > buf( tmp.begin(), tmp.end() ); buf.push_back( 0 );
+    fd = mkstemp( &buf[0] );
+    if( fd < 0 )
+      { show_error( "Can't create map swap file", errno ); std::exit( 1 ); }
+    unlink( &buf[0] );			// removed when closed
+    }
+  return slots++;
+  }
+
+
+void Sblock_map::Pager::io( const bool write, Node * const n )
+  {
+  uint8_t * const buf = reinterpret_cast< uint8_t * >( n->pos );
+  const long long offset = (long long)n->slot * slot_size;
+  int done = 0;
+  while( done < slot_size )
+    {
+    errno = 0;
+    const int rd = write ?
+      pwrite( fd, buf + done, slot_size - done, offset + done ) :
+      pread( fd, buf + done, slot_size - done, offset + done );
+    if( rd > 0 ) done += rd;
+    else if( rd < 0 && errno == EINTR ) continue;
+    else
+      {
+      show_error( write ? "Error writing map swap file" :
+                          "Error reading map swap file", errno );
+      std::exit( 1 );
+      }
+    }
+  }
+
+
+Sblock_map::Sblock_map()
+  : pager( 0 ), root( 0 ), last( 0 ), size_( 0 ), end_( 0 ), cur( 0 ),
+    cur_base( 0 )
+  { root = last = cur = new_leaf(); recount(); }
+
+
+// Copy the sblocks of 'm' in runs, filling the new leaves, and build the
+// internal nodes at the end. This costs about as much as a memcpy of the
+// leaves, so that snapshots of the logfile can be taken often.
+//
+Sblock_map::Sblock_map( const Sblock_map & m )
+  : pager( m.pager ? new Pager( m.pager->max_memory, m.pager->name ) : 0 ),
+    root( 0 ), last( 0 ), size_( 0 ), end_( m.end_ ), cur( 0 ), cur_base( 0 )
+  {
+  root = last = cur = new_leaf();
+  Node * w = last;			// leaf being written
+  for( Node * n = m.root->first; n; n = n->next )
+    {
+    m.touch( n );
+    for( int a = 0; a < n->n; )		// copy whole runs of sblocks
+      {
+      if( w->n >= max_blocks )
+        {
+        w->first_pos = w->pos[0]; w->mask = w->compute_mask();
+        Node * const r = new_leaf();
+        r->prev = w; w->next = r; last = w = r;
+        }
+      const int c = std::min( n->n - a, max_blocks - w->n );
+      std::memcpy( w->pos + w->n, n->pos + a, c * sizeof w->pos[0] );
+      std::memcpy( w->st + w->n, n->st + a, c );
+      w->n += c; a += c; size_ += c;
+      }
+    }
+  if( w->n > 0 ) { w->first_pos = w->pos[0]; w->mask = w->compute_mask(); }
+  rebuild_index( root );
+  cur = root->first; touch( cur );
+  for( int s = 0; s < 5; ++s )
+    { status_size_[s] = m.status_size_[s];
+      status_count_[s] = m.status_count_[s];
+      status_runs_[s] = m.status_runs_[s]; }
+  }
+
+
+Sblock_map & Sblock_map::operator=( const Sblock_map & m )
+  {
+  if( this != &m ) { Sblock_map tmp( m ); swap( tmp ); }
+  return *this;
+  }
+
+
+Sblock_map::~Sblock_map() { delete_tree( root ); delete pager; }
+
+
+Sblock_map::Node * Sblock_map::new_leaf()
+  {
+  Node * const n = new Node( true );
+  if( pager ) { pager->add( n ); evict( n ); }
+  return n;
+  }
+
+
+void Sblock_map::delete_leaf( Node * const n )
+  {
+  if( pager )
+    {
+    if( n->ring >= 0 ) pager->remove( n );
+    if( n->slot >= 0 ) pager->free_slots.push_back( n->slot );
+    }
+  delete n;
+  }
+
+
+void Sblock_map::delete_tree( Node * const n )
+  {
+  if( n->leaf ) { delete_leaf( n ); return; }
+  for( unsigned k = 0; k < n->children.size(); ++k )
+    delete_tree( n->children[k] );
+  delete n;
+  }
+
+
+void Sblock_map::page_in( Node * const n ) const
+  {
+  n->pos = new long long[leaf_words];
+  n->st = reinterpret_cast< char * >( n->pos + max_blocks + 1 );
+  pager->io( false, n );
+  n->dirty = false;
+  pager->add( n );
+  evict( n );
+  }
+
+
+void Sblock_map::page_out( Node * const n ) const
+  {
+  if( n->dirty )
+    {
+    if( n->slot < 0 ) n->slot = pager->new_slot();
+    pager->io( true, n );
+    n->dirty = false;
+    }
+  delete[] n->pos; n->pos = 0; n->st = 0;
+  pager->remove( n );
+  }
+
+
+// Write to the swap file the leaves not used recently, skipping the
+// cursor and 'keep', until at most 'max_resident' leaves remain in memory.
+//
+void Sblock_map::evict( const Node * const keep ) const
+  {
+  std::vector< Node * > & r = pager->resident;
+  while( (int)r.size() > pager->max_resident )
+    {
+    if( pager->hand >= r.size() ) pager->hand = 0;
+    Node * const n = r[pager->hand];
+    if( n == cur || n == keep || n->used )
+      { n->used = false; ++pager->hand; }
+    else page_out( n );		// moves the last leaf to this position
+    }
+  }
+
+
+long long Sblock_map::max_memory() const
+  { return pager ? pager->max_memory : 0; }
+
+
+// Keep in memory at most about 'bytes' bytes of sblocks. The rest are
+// paged out to a temporary file created in the directory of 'name'.
+//
+void Sblock_map::limit_memory( const long long bytes, const char * const name )
+  {
+  if( bytes <= 0 || pager ) return;
+  pager = new Pager( bytes, name ? name : "" );
+  for( Node * n = root->first; n; n = n->next ) pager->add( n );
+  evict( 0 );
+  }
+
+
+void Sblock_map::limit_memory( const Sblock_map & m )
+  { if( m.pager ) limit_memory( m.pager->max_memory, m.pager->name.c_str() ); }
+
+
+// Move the cursor to the leaf containing index 'i'.
+//
+void Sblock_map::seek( const int i ) const
+  {
+  const int end = cur_base + cur->n;
+  if( cur->next && i >= end && i < end + cur->next->n )
+    { cur = cur->next; cur_base = end; touch( cur ); return; }
+  if( cur->prev && i < cur_base && i >= cur_base - cur->prev->n )
+    { cur = cur->prev; cur_base -= cur->n; touch( cur ); return; }
+  Node * n = root;
+  int base = 0;
+  while( !n->leaf )
+    {
+    unsigned k = 0;
+    while( k + 1 < n->children.size() && i - base >= n->counts[k] )
+      { base += n->counts[k]; ++k; }
+    n = n->children[k];
+    }
+  cur = n; cur_base = base; touch( cur );
+  }
+
+
+// Add a sblock beginning at 'p' with status 'st' at the end of the map.
+// The end of the map is not changed.
+//
+void Sblock_map::append( const long long p, const char st )
+  {
+  if( last->n >= max_blocks ) { insert( size_, p, st ); return; }
+  touch( last );
+  if( last->n == 0 ) last->first_pos = p;
+  last->pos[last->n] = p;		// fast path; no split needed
+  last->st[last->n++] = st;
+  last->dirty = true;
+  const int bit = status_bit( Sblock::Status( st ) );
+  last->mask |= bit;
+  for( Node * n = root; !n->leaf; n = n->children.back() )
+    { ++n->counts.back(); n->mask |= bit; }
+  ++size_;
+  }
+
+
+// Insert a sblock beginning at 'p' with status 'st' at index 'i' of the
+// subtree 'n', whose first sblock has index 'base'. Returns the new right
+// sibling of 'n' if 'n' was split.
+// When appending to the map, full nodes are left full instead of being
+// split in halves, so that a map built by appending is compact.
+//
+Sblock_map::Node * Sblock_map::insert( Node * const n, const int i,
+                                       const long long p, const char st,
+                                       const int base )
+  {
+  const bool append = ( base + i == size_ );
+  int half;
+  n->mask |= status_bit( Sblock::Status( st ) );
+  if( n->leaf )
+    {
+    touch( n );
+    std::memmove( n->pos + i + 1, n->pos + i, ( n->n - i ) * sizeof n->pos[0] );
+    std::memmove( n->st + i + 1, n->st + i, n->n - i );
+    n->pos[i] = p; n->st[i] = st; ++n->n;
+    n->first_pos = n->pos[0]; n->dirty = true;
+    cur = n; cur_base = base;
+    if( n->n <= max_blocks ) return 0;
+    half = append ? n->n - 1 : n->n / 2;
+    Node * const r = new_leaf();
+    r->n = n->n - half; n->n = half;
+    std::memcpy( r->pos, n->pos + half, r->n * sizeof n->pos[0] );
+    std::memcpy( r->st, n->st + half, r->n );
+    r->first_pos = r->pos[0];
+    n->mask = n->compute_mask(); r->mask = r->compute_mask();
+    r->prev = n; r->next = n->next;
+    if( r->next ) r->next->prev = r; else last = r;
+    n->next = r;
+    if( i >= half ) { cur = r; cur_base = base + half; }
+    return r;
+    }
+  unsigned k = 0;
+  int j = i;				// index relative to child k
+  while( k + 1 < n->children.size() && j > n->counts[k] )
+    { j -= n->counts[k]; ++k; }
+  Node * const s = insert( n->children[k], j, p, st, base + ( i - j ) );
+  ++n->counts[k];
+  if( s )
+    {
+    const int c = s->count();
+    n->counts[k] -= c;
+    n->children.insert( n->children.begin() + ( k + 1 ), s );
+    n->counts.insert( n->counts.begin() + ( k + 1 ), c );
+    s->parent = n;
+    }
+  n->first = n->children[0]->first;
+  const int size = n->children.size();
+  if( size <= max_children ) return 0;
+  half = append ? size - 1 : size / 2;
+  Node * const r = new Node( false );
+  r->children.assign( n->children.begin() + half, n->children.end() );
+  r->counts.assign( n->counts.begin() + half, n->counts.end() );
+  n->children.erase( n->children.begin() + half, n->children.end() );
+  n->counts.erase( n->counts.begin() + half, n->counts.end() );
+  r->first = r->children[0]->first;
+  for( unsigned k = 0; k < r->children.size(); ++k )
+    r->children[k]->parent = r;
+  n->mask = n->compute_mask(); r->mask = r->compute_mask();
+  return r;
+  }
+
+
+void Sblock_map::insert( const int i, const long long p, const char st )
+  {
+  Node * const s = insert( root, i, p, st, 0 );
+  ++size_;
+  if( s )				// grow the tree one level
+    {
+    Node * const r = new Node( false );
+    r->children.push_back( root ); r->counts.push_back( root->count() );
+    r->children.push_back( s ); r->counts.push_back( s->count() );
+    r->first = root->first;
+    r->mask = root->mask | s->mask;
+    root->parent = r; s->parent = r;
+    root = r;
+    }
+  }
+
+
+// Erase the sblock at index 'i' of the subtree 'n'.
+// Returns true if 'n' is now empty and has been unlinked.
+// Empty nodes are removed, but nodes are not merged with their siblings.
+//
+bool Sblock_map::erase( Node * const n, const int i )
+  {
+  if( n->leaf )
+    {
+    touch( n );
+    --n->n;
+    std::memmove( n->pos + i, n->pos + i + 1, ( n->n - i ) * sizeof n->pos[0] );
+    std::memmove( n->st + i, n->st + i + 1, n->n - i );
+    n->first_pos = n->pos[0]; n->dirty = true;
+    if( n->n > 0 || n == root ) { n->update_mask(); return false; }
+    if( n->prev ) n->prev->next = n->next;
+    if( n->next ) n->next->prev = n->prev; else last = n->prev;
+    return true;
+    }
+  unsigned k = 0;
+  int j = i;
+  while( k + 1 < n->children.size() && j >= n->counts[k] )
+    { j -= n->counts[k]; ++k; }
+  if( erase( n->children[k], j ) )
+    {
+    if( n->children[k]->leaf ) delete_leaf( n->children[k] );
+    else delete n->children[k];
+    n->children.erase( n->children.begin() + k );
+    n->counts.erase( n->counts.begin() + k );
+    if( n->children.empty() ) return true;
+    n->update_mask();
+    }
+  else --n->counts[k];
+  n->first = n->children[0]->first;
+  return false;
+  }
+
+
+void Sblock_map::clear()
+  {
+  delete_tree( root );
+  root = last = cur = new_leaf();
+  size_ = 0; end_ = 0; cur_base = 0;
+  recount();
+  }
+
+
+// Add 'sb' at the end of the map. 'sb' must begin where the map ends,
+// unless the map is empty.
+//
+void Sblock_map::push_back( const Sblock & sb )
+  {
+  account( size_ - 1, size_, -1 );
+  append( sb.pos(), sb.status() );
+  end_ = sb.end();
+  account( size_ - 2, size_, 1 );
+  }
+
+
+// Insert a sblock beginning at 'sb.pos()' with status 'sb.status()' at
+// index 'i'. The size of 'sb' is ignored; the new sblock ends where the
+// sblock 'i' began (or at the end of the map), and the sblock 'i' - 1
+// now ends at 'sb.pos()'.
+//
+void Sblock_map::insert( const int i, const Sblock & sb )
+  {
+  if( size_ == 0 ) { push_back( sb ); return; }
+  account( i - 1, i, -1 );
+  insert( i, sb.pos(), sb.status() );
+  account( i - 1, i + 1, 1 );
+  }
+
+
+// Erase the sblocks from index 'i' to index 'j' - 1. The sblock 'i' - 1,
+// if any, grows to cover them; as if they were joined to it.
+//
+void Sblock_map::erase( const int i, const int j )
+  {
+  account( i - 1, j, -1 );
+  erase_range( i, j );
+  account( i - 1, i, 1 );
+  }
+
+
+// Erase the sblocks from index 'i' to index 'j' - 1 without updating the
+// status counters.
+//
+void Sblock_map::erase_range( const int i, const int j )
+  {
+  for( int k = j - 1; k >= i; --k )
+    {
+    if( erase( root, k ) )		// map is now empty
+      { delete root; root = last = cur = new_leaf(); }
+    --size_;
+    }
+  while( !root->leaf && root->children.size() == 1 )	// shrink the tree
+    {
+    Node * const r = root->children[0];
+    root->children.clear();
+    delete root;
+    root = r; root->parent = 0;
+    }
+  cur = root->first; cur_base = 0; touch( cur );
+  if( i < size_ ) seek( i );
+  }
+
+
+// Erase the sblocks from index 'i' to the end. The map now ends where
+// the sblock 'i' began.
+//
+void Sblock_map::truncate( const int i )
+  {
+  if( i >= size_ ) return;
+  const long long end = pos( i );
+  account( i, size_, -1 );
+  erase_range( i, size_ );
+  end_ = end;
+  }
+
+
+// Split the sblock 'i' in two at 'p'. Both parts keep the status.
+//
+void Sblock_map::split( const int i, const long long p )
+  {
+  const int j = index_in_leaf( i );
+  const char st = cur->st[j];
+  account( i, i + 1, -1 );
+  insert( i + 1, p, st );
+  account( i, i + 2, 1 );
+  }
+
+
+// Split the sblock strictly including 'p', if any, in two at 'p'.
+// Returns true if a sblock was split.
+//
+bool Sblock_map::split_at( const long long p )
+  {
+  const int i = find( p );
+  if( i < 0 || pos( i ) == p || p >= end( i ) ) return false;
+  split( i, p );
+  return true;
+  }
+
+
+// Move the beginning of the sblock 'i' (and the end of the sblock 'i' - 1)
+// to 'p'.
+//
+void Sblock_map::move_pos( const int i, const long long p )
+  {
+  account( i - 1, i + 1, -1 );
+  const int j = index_in_leaf( i );
+  cur->pos[j] = p; cur->dirty = true;
+  if( j == 0 ) cur->first_pos = p;
+  account( i - 1, i + 1, 1 );
+  }
+
+
+void Sblock_map::move_end( const long long e )
+  {
+  account( size_ - 1, size_, -1 );
+  end_ = e;
+  account( size_ - 1, size_, 1 );
+  }
+
+
+void Sblock_map::status( const int i, const Sblock::Status st )
+  {
+  if( status( i ) == st ) return;
+  account( i, i + 1, -1 );
+  const int j = index_in_leaf( i );
+  cur->st[j] = st; cur->dirty = true;
+  cur->update_mask();
+  account( i, i + 1, 1 );
+  }
+
+
+// Add ('sign' = 1) or subtract ('sign' = -1) to the status counters the
+// sizes of the sblocks from 'i' to 'j' - 1, and the runs beginning at the
+// sblocks from 'i' to 'j'. Mutators subtract the sblocks they change, and
+// add them back once changed, so that the counters are always up to date.
+//
+void Sblock_map::account( const int i, const int j, const int sign )
+  {
+  for( int k = std::max( i, 0 ); k <= j && k < size_; ++k )
+    {
+    const Sblock::Status st = status( k );
+    const int s = status_index( st );
+    if( k < j ) { status_size_[s] += sign * ( end( k ) - pos( k ) );
+                  status_count_[s] += sign; }
+    if( k == 0 || status( k - 1 ) != st ) status_runs_[s] += sign;
+    }
+  }
+
+
+void Sblock_map::recount()
+  {
+  for( int s = 0; s < 5; ++s )
+    { status_size_[s] = 0; status_count_[s] = 0; status_runs_[s] = 0; }
+  account( 0, size_, 1 );
+  }
+
+
+// Returns the index of the last sblock beginning at or before 'pos',
+// or -1 if there is none.
+//
+int Sblock_map::find( const long long pos ) const
+  {
+  if( size_ == 0 ) return -1;
+  if( cur->n <= 0 || pos < cur->first_pos || pos >= leaf_end( cur ) )
+    {
+    Node * n = root;
+    int base = 0;
+    while( !n->leaf )
+      {
+      unsigned l = 1, r = n->children.size();	// first child beyond pos
+      while( l < r )
+        {
+        const unsigned m = l + ( r - l ) / 2;
+        if( n->children[m]->first->first_pos <= pos ) l = m + 1; else r = m;
+        }
+      for( unsigned k = 0; k + 1 < l; ++k ) base += n->counts[k];
+      n = n->children[l-1];
+      }
+    cur = n; cur_base = base; touch( cur );
+    }
+  int l = 0, r = cur->n;			// first sblock beyond pos
+  while( l < r )
+    {
+    const int m = l + ( r - l ) / 2;
+    if( cur->pos[m] <= pos ) l = m + 1; else r = m;
+    }
+  return cur_base + l - 1;
+  }
+
+
+// Returns the index of the first sblock of the subtree 'n' with index
+// >= 'i' and status 'st', or -1 if there is none.
+//
+int Sblock_map::find_status( Node * const n, const int i,
+                             const Sblock::Status st, int base ) const
+  {
+  if( !( n->mask & status_bit( st ) ) ) return -1;
+  if( n->leaf )
+    {
+    touch( n );
+    for( int j = std::max( i - base, 0 ); j < n->n; ++j )
+      if( n->st[j] == st ) { cur = n; cur_base = base; return base + j; }
+    return -1;
+    }
+  for( unsigned k = 0; k < n->children.size(); ++k )
+    {
+    if( i < base + n->counts[k] )
+      {
+      const int j = find_status( n->children[k], i, st, base );
+      if( j >= 0 ) return j;
+      }
+    base += n->counts[k];
+    }
+  return -1;
+  }
+
+
+// Returns the index of the last sblock of the subtree 'n' with index
+// <= 'i' and status 'st', or -1 if there is none.
+//
+int Sblock_map::rfind_status( Node * const n, const int i,
+                              const Sblock::Status st, int base ) const
+  {
+  if( !( n->mask & status_bit( st ) ) ) return -1;
+  if( n->leaf )
+    {
+    touch( n );
+    for( int j = std::min( i - base, n->n - 1 ); j >= 0; --j )
+      if( n->st[j] == st ) { cur = n; cur_base = base; return base + j; }
+    return -1;
+    }
+  for( unsigned k = 0; k < n->counts.size(); ++k ) base += n->counts[k];
+  for( int k = n->children.size() - 1; k >= 0; --k )
+    {
+    base -= n->counts[k];
+    if( i >= base )
+      {
+      const int j = rfind_status( n->children[k], i, st, base );
+      if( j >= 0 ) return j;
+      }
+    }
+  return -1;
+  }
+
+
+// Returns the index of the first sblock with index >= 'i' and status
+// 'st', or -1 if there is none. Searches the leaf of the cursor first.
+//
+int Sblock_map::find_status( const int i, const Sblock::Status st ) const
+  {
+  if( i >= size_ ) return -1;
+  if( i < cur_base || i >= cur_base + cur->n ) seek( std::max( i, 0 ) );
+  const int j = find_status( cur, i, st, cur_base );
+  if( j >= 0 ) return j;
+  return find_status( root, cur_base + cur->n, st, 0 );
+  }
+
+
+// Returns the index of the last sblock with index <= 'i' and status
+// 'st', or -1 if there is none. Searches the leaf of the cursor first.
+//
+int Sblock_map::rfind_status( const int i, const Sblock::Status st ) const
+  {
+  if( i < 0 || size_ == 0 ) return -1;
+  if( i < cur_base || i >= cur_base + cur->n ) seek( std::min( i, size_ - 1 ) );
+  const int j = rfind_status( cur, i, st, cur_base );
+  if( j >= 0 ) return j;
+  return rfind_status( root, cur_base - 1, st, 0 );
+  }
+
+
+// Delete the internal nodes of the subtree 'n', leaving its leaves.
+//
+void Sblock_map::delete_index( Node * const n )
+  {
+  if( n->leaf ) return;
+  for( unsigned k = 0; k < n->children.size(); ++k )
+    delete_index( n->children[k] );
+  delete n;
+  }
+
+
+// Build the internal nodes of the tree over the list of leaves beginning
+// at 'first', whose masks must be up to date. Nodes are left full.
+//
+void Sblock_map::rebuild_index( Node * const first )
+  {
+  std::vector< Node * > level;
+  for( Node * n = first; n; n = n->next )
+    { n->parent = 0; level.push_back( n ); }
+  while( level.size() > 1 )
+    {
+    unsigned l = 0;
+    for( unsigned k = 0; k < level.size(); k += max_children, ++l )
+      {
+      Node * const p = new Node( false );
+      const unsigned e = std::min( k + max_children, (unsigned)level.size() );
+      for( unsigned c = k; c < e; ++c )
+        {
+        p->children.push_back( level[c] );
+        p->counts.push_back( level[c]->count() );
+        p->mask |= level[c]->mask;
+        level[c]->parent = p;
+        }
+      p->first = level[k]->first;
+      level[l] = p;
+      }
+    level.resize( l );
+    }
+  root = level[0];
+  }
+
+
+// Join the consecutive sblocks with the same status. The sblocks are
+// moved toward the beginning of the leaves in place, the leaves left
+// empty are deleted, and the internal nodes are then rebuilt.
+//
+void Sblock_map::compact()
+  {
+  if( size_ <= 1 ) return;
+  Node * const first = root->first;
+  Node * r = first;			// leaf being read
+  Node * w = first;			// leaf being written
+  int b = 0;				// sblocks written in w
+  int size = 0;
+  char st = 0;				// status of last sblock written
+  cur = w; touch( w );			// the cursor protects w from eviction
+  for( ; r; r = r->next )
+    {
+    touch( r );
+    for( int a = 0; a < r->n; ++a )
+      {
+      if( size > 0 && r->st[a] == st ) continue;
+      st = r->st[a];
+      if( b >= w->n )			// w is full; r is beyond w
+        {
+        w->mask = w->compute_mask(); w->first_pos = w->pos[0];
+        w = w->next; b = 0;
+        cur = w; touch( w ); touch( r );
+        }
+      w->pos[b] = r->pos[a]; w->st[b++] = r->st[a]; ++size;
+      w->dirty = true;
+      }
+    }
+  w->n = b;
+  w->mask = w->compute_mask(); w->first_pos = w->pos[0];
+  delete_index( root );
+  for( Node * n = w->next; n; )
+    { Node * const next = n->next; delete_leaf( n ); n = next; }
+  w->next = 0; last = w;
+  size_ = size;
+  rebuild_index( first );
+  cur = root->first; cur_base = 0; touch( cur );
+  recount();
+  }
+
+
+// Move the first 'size' sblocks of the buffer 'bpos', 'bst' to the leaf
+// 'n', or to a new leaf linked after 'prev' if 'n' is 0. Returns the leaf.
+//
+Sblock_map::Node * Sblock_map::fill_leaf( Node * const prev, Node * n,
+                                          std::vector< long long > & bpos,
+                                          std::vector< char > & bst,
+                                          const int size )
+  {
+  if( !n )
+    {
+    n = new_leaf();
+    n->prev = prev; n->next = prev->next;
+    if( n->next ) n->next->prev = n; else last = n;
+    prev->next = n;
+    }
+  else touch( n );
+  std::memcpy( n->pos, &bpos[0], size * sizeof n->pos[0] );
+  std::memcpy( n->st, &bst[0], size );
+  n->n = size; n->first_pos = n->pos[0]; n->dirty = true;
+  n->mask = n->compute_mask();
+  bpos.erase( bpos.begin(), bpos.begin() + size );
+  bst.erase( bst.begin(), bst.begin() + size );
+  return n;
+  }
+
+
+// Split the sblocks including a border of the sblocks of 'm', walking both
+// maps once. The sblocks of each leaf, and the new ones, are written back
+// in order through a buffer of at most 'max_blocks' sblocks, filling the
+// leaf and new leaves linked after it. The internal nodes are then rebuilt.
+//
+void Sblock_map::split_by( const Sblock_map & m )
+  {
+  if( size_ == 0 || m.size_ == 0 || &m == this ) return;
+  std::vector< long long > bpos; std::vector< char > bst;
+  bpos.reserve( max_blocks ); bst.reserve( max_blocks );
+  long long tpos[max_blocks]; char tst[max_blocks];	// leaf being read
+  int j = 0;				// next border of 'm'
+  long long q = m.pos( 0 );
+  Node * const first = root->first;
+  Node * out = 0;			// last leaf written
+  int size = 0;
+  for( Node * r = first; r; )
+    {
+    Node * const next = r->next;
+    const long long end = leaf_end( r );
+    touch( r ); cur = r;
+    const int rn = r->n;
+    std::memcpy( tpos, r->pos, rn * sizeof tpos[0] );
+    std::memcpy( tst, r->st, rn );
+    bool filled = false;		// r has been written
+    for( int a = 0; a < rn; ++a )
+      {
+      const long long e = ( a + 1 < rn ) ? tpos[a+1] : end;
+      long long p = tpos[a];
+      while( true )			// copy the sblock and its parts
+        {
+        bpos.push_back( p ); bst.push_back( tst[a] );
+        if( (int)bpos.size() >= max_blocks )
+          {
+          out = fill_leaf( out, filled ? 0 : r, bpos, bst, max_blocks );
+          filled = true; cur = out; size += max_blocks;
+          }
+        while( j <= m.size_ && q <= p )
+          q = ( ++j < m.size_ ) ? m.pos( j ) : m.end_;
+        if( j > m.size_ || q >= e ) break;
+        p = q;
+        }
+      }
+    if( !filled && bpos.size() )	// r can't be left empty
+      {
+      size += bpos.size();
+      out = fill_leaf( out, r, bpos, bst, bpos.size() ); cur = out;
+      }
+    r = next;
+    }
+  if( bpos.size() )
+    { size += bpos.size(); fill_leaf( out, 0, bpos, bst, bpos.size() ); }
+  delete_index( root );
+  size_ = size;
+  rebuild_index( first );
+  cur = root->first; cur_base = 0; touch( cur );
+  recount();
+  }
+
+
+void Sblock_map::swap( Sblock_map & m )
+  {
+  std::swap( pager, m.pager );
+  std::swap( root, m.root ); std::swap( last, m.last );
+  std::swap( size_, m.size_ ); std::swap( end_, m.end_ );
+  std::swap( cur, m.cur ); std::swap( cur_base, m.cur_base );
+  for( int s = 0; s < 5; ++s )
+    { std::swap( status_size_[s], m.status_size_[s] );
+      std::swap( status_count_[s], m.status_count_[s] );
+      std::swap( status_runs_[s], m.status_runs_[s] ); }
   }
@@ -117,6 +117,9 @@ public:
 class Domain
   {
   std::vector< Block > block_vector;	// blocks are ordered and don't overlap
+  long long in_size_;			// sum of the sizes of the blocks
+
+  void update_in_size();
 
 public:
   Domain( const long long p, const long long s,
@@ -130,13 +133,7 @@ public:
   bool empty() const { return ( end() <= pos() ); }
   bool full() const { return ( !empty() && end() >= LLONG_MAX ); }
 
-  long long in_size() const
-    {
-    long long s = 0;
-    for( unsigned i = 0; i < block_vector.size(); ++i )
-      s += block_vector[i].size();
-    return s;
-    }
+  long long in_size() const { return in_size_; }
 
   bool operator!=( const Domain & d ) const
     {
@@ -149,30 +146,193 @@ public:
   bool operator<( const Block & b ) const { return ( end() <= b.pos() ); }
   bool operator>( const Block & b ) const { return ( pos() >= b.end() ); }
 
+  int find( const long long pos ) const;
+  int find( const long long pos, int & cursor ) const;
   bool includes( const Block & b ) const
+    { const int i = find( b.end() - 1 );
+      return ( i < blocks() && block_vector[i].includes( b ) ); }
+  bool includes( const Block & b, int & cursor ) const
+    { const int i = find( b.end() - 1, cursor );
+      return ( i < blocks() && block_vector[i].includes( b ) ); }
+  bool includes( const long long pos ) const
+    { const int i = find( pos );
+      return ( i < blocks() && block_vector[i].includes( pos ) ); }
+
+  void clear()
+    { block_vector.clear(); block_vector.push_back( Block( 0, 0 ) );
+      in_size_ = 0; }
+  void crop( const Block & b );
+  void crop_by_file_size( const long long size ) { crop( Block( 0, size ) ); }
+  };
+
+
+// Sequence of consecutive sblocks stored in a B+tree, so that inserting
+// or erasing a sblock anywhere takes O(log n) time. Each internal node
+// keeps the number of sblocks in each of its subtrees, so that sblocks
+// can be accessed by index. A cursor remembers the last leaf accessed,
+// making sequential and nearby accesses O(1).
+// Each node also keeps the set of statuses present in its subtree, so
+// that the next sblock with a given status is found in O(log n) time.
+// As the sblocks are consecutive, the leaves only store the beginning and
+// the status of each sblock (9 bytes instead of the 24 of a Sblock); each
+// sblock ends where the next one begins. Therefore sblocks are returned
+// by value, and can only be changed through the functions of the map.
+//
+class Sblock_map
+  {
+  enum { max_blocks = 64, max_children = 64,
+         leaf_words = max_blocks + 1 + ( max_blocks + 8 ) / 8 };
+  struct Pager;				// swap file of leaves, in block.cc
+  struct Node
+    {
+    std::vector< Node * > children;	// subtrees, if internal node
+    std::vector< int > counts;		// sblocks in each subtree
+    Node * first;			// leftmost leaf of subtree
+    Node * prev, * next;		// neighbor leaves
+    Node * parent;
+    int mask;				// statuses present in subtree
+    int n;				// number of sblocks, if leaf
+    const bool leaf;
+    long long * pos;			// beginning of each sblock, or 0
+					//   if the leaf is paged out
+    char * st;				// status of each sblock
+    long long first_pos;		// copy of pos[0], kept when paged out
+    int slot;				// slot in swap file, or -1
+    int ring;				// index in list of resident leaves
+    bool dirty;				// changed since written to swap file
+    bool used;				// accessed since last eviction sweep
+
+    explicit Node( const bool is_leaf )
+      : first( is_leaf ? this : 0 ), prev( 0 ), next( 0 ), parent( 0 ),
+        mask( 0 ), n( 0 ), leaf( is_leaf ),
+        pos( is_leaf ? new long long[leaf_words] : 0 ),
+        st( leaf ? reinterpret_cast< char * >( pos + max_blocks + 1 ) : 0 ),
+        first_pos( 0 ), slot( -1 ), ring( -1 ), dirty( true ), used( true )
+      { if( !leaf ) { children.reserve( max_children + 1 );
+                      counts.reserve( max_children + 1 ); } }
+    ~Node() { delete[] pos; }
+    int count() const;
+    int compute_mask() const;
+    void update_mask();
+    };
+
+  Pager * pager;			// paging of leaves, or 0
+  Node * root;
+  Node * last;				// rightmost leaf
+  int size_;
+  long long end_;			// end of last sblock
+  long long status_size_[5];		// total size of each status
+  int status_count_[5];			// sblocks of each status
+  int status_runs_[5];			// runs of consecutive sblocks
+  mutable Node * cur;			// cursor; leaf of last access
+  mutable int cur_base;			// index of first sblock in cur
+
+  static int status_bit( const Sblock::Status st )
     {
-    unsigned l = 0, r = block_vector.size();
-    while( l < r )
+    switch( st )
       {
-      const int m = ( l + r ) / 2;
-      const Block & db = block_vector[m];
-      if( db.includes( b ) ) return true;
-      if( db < b ) l = m + 1; else if( b < db ) r = m; else break;
+      case Sblock::non_tried:   return 1;
+      case Sblock::non_trimmed: return 2;
+      case Sblock::non_scraped: return 4;
+      case Sblock::bad_sector:  return 8;
+      case Sblock::finished:    return 16;
       }
-    return false;
+    return 0;
     }
-
-  bool includes( const long long pos ) const
+  static int status_index( const Sblock::Status st )
     {
-    for( unsigned i = 0; i < block_vector.size(); ++i )
-      if( block_vector[i].includes( pos ) ) return true;
-    return false;
+    switch( st )
+      {
+      case Sblock::non_tried:   return 0;
+      case Sblock::non_trimmed: return 1;
+      case Sblock::non_scraped: return 2;
+      case Sblock::bad_sector:  return 3;
+      case Sblock::finished:    return 4;
+      }
+    return 0;
     }
+  Node * new_leaf();
+  void delete_leaf( Node * const n );
+  void delete_tree( Node * const n );
+  void page_in( Node * const n ) const;
+  void page_out( Node * const n ) const;
+  void evict( const Node * const keep ) const;
+  void touch( Node * const n ) const		// make leaf 'n' resident
+    { if( !n->pos ) page_in( n ); n->used = true; }
+  void seek( const int i ) const;
+  int index_in_leaf( const int i ) const	// move cursor to sblock 'i'
+    { if( i < cur_base || i >= cur_base + cur->n ) seek( i );
+      return i - cur_base; }
+  long long leaf_end( const Node * const n ) const
+    { return n->next ? n->next->first_pos : end_; }
+  void append( const long long p, const char st );
+  Node * insert( Node * const n, const int i, const long long p,
+                 const char st, const int base );
+  void insert( const int i, const long long p, const char st );
+  bool erase( Node * const n, const int i );
+  void erase_range( const int i, const int j );
+  void account( const int i, const int j, const int sign );
+  void recount();
+  static void delete_index( Node * const n );
+  void rebuild_index( Node * const first );
+  Node * fill_leaf( Node * const prev, Node * n, std::vector< long long > & bpos,
+                    std::vector< char > & bst, const int size );
+  int find_status( Node * const n, const int i, const Sblock::Status st,
+                   int base ) const;
+  int rfind_status( Node * const n, const int i, const Sblock::Status st,
+                    int base ) const;
 
-  void clear()
-    { block_vector.clear(); block_vector.push_back( Block( 0, 0 ) ); }
-  void crop( const Block & b );
-  void crop_by_file_size( const long long size ) { crop( Block( 0, size ) ); }
+public:
+  Sblock_map();
+  Sblock_map( const Sblock_map & m );
+  Sblock_map & operator=( const Sblock_map & m );
+  ~Sblock_map();
+
+  unsigned size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  long long pos( const int i ) const
+    { const int j = index_in_leaf( i ); return cur->pos[j]; }
+  long long end( const int i ) const
+    { const int j = index_in_leaf( i );
+      return ( j + 1 < cur->n ) ? cur->pos[j+1] : leaf_end( cur ); }
+  Sblock::Status status( const int i ) const
+    { const int j = index_in_leaf( i ); return Sblock::Status( cur->st[j] ); }
+  Sblock operator[]( const int i ) const
+    { const int j = index_in_leaf( i );
+      const long long p = cur->pos[j];
+      const long long e = ( j + 1 < cur->n ) ? cur->pos[j+1] : leaf_end( cur );
+      return Sblock( p, e - p, Sblock::Status( cur->st[j] ) ); }
+  Sblock front() const { return (*this)[0]; }
+  Sblock back() const { return (*this)[size_-1]; }
+  long long end() const { return end_; }
+  long long max_memory() const;
+  long long status_size( const Sblock::Status st ) const
+    { return status_size_[status_index( st )]; }
+  int status_count( const Sblock::Status st ) const
+    { return status_count_[status_index( st )]; }
+  int status_runs( const Sblock::Status st ) const
+    { return status_runs_[status_index( st )]; }
+
+  void limit_memory( const long long bytes, const char * const name );
+  void limit_memory( const Sblock_map & m );
+  void clear();
+  void push_back( const Sblock & sb );
+  void pop_back() { truncate( size_ - 1 ); }
+  void insert( const int i, const Sblock & sb );
+  void erase( const int i, const int j );
+  void truncate( const int i );
+  void split( const int i, const long long p );
+  bool split_at( const long long p );
+  void split_by( const Sblock_map & m );
+  void move_pos( const int i, const long long p );	// shift border
+  void move_end( const long long e );			// resize last sblock
+  void status( const int i, const Sblock::Status st );
+  int find( const long long pos ) const;
+  int find_status( const int i, const Sblock::Status st ) const;
+  int rfind_status( const int i, const Sblock::Status st ) const;
+  void compact();
+  void swap( Sblock_map & m );
   };
 
 
@@ -190,24 +350,50 @@ private:
   Status current_status_;
   mutable int index_;			// cached index of last find or change
   bool read_only_;
-  std::vector< Sblock > sblock_vector;	// note: blocks are consecutive
-
-  void insert_sblock( const int i, const Sblock & sb )
-    { sblock_vector.insert( sblock_vector.begin() + i, sb ); }
+  bool binary_;				// read/write in binary format
+  Sblock_map sblock_vector;		// note: blocks are consecutive
+					// variables for the journal
+  mutable std::string journal_buf;	// changes not yet appended
+  mutable long long journal_size_;	// size of journal file
+  mutable bool journal_exists_;		// journal file may exist
+  mutable bool rewrite_needed_;		// change not recorded in journal
+  bool journaling_;			// record changes in journal
+
+  void set_status( const Block & b, const Sblock::Status st );
+  bool replay_journal();
+  bool read_binary_logfile( FILE * const f, const int default_sblock_status );
+  bool write_binary_logfile( FILE * const f ) const;
 
 public:
   explicit Logfile( const char * const logname )
     : current_pos_( 0 ), filename_( logname ), current_status_( copying ),
-      index_( 0 ), read_only_( false ) {}
+      index_( 0 ), read_only_( false ), binary_( false ), journal_size_( 0 ),
+      journal_exists_( false ), rewrite_needed_( false ),
+      journaling_( false ) {}
 
-  void compact_sblock_vector();
+  void compact_sblock_vector() { sblock_vector.compact(); }
   void extend_sblock_vector( const long long isize );
   bool truncate_vector( const long long end, const bool force = false );
+  void limit_map_memory( const long long bytes )
+    { sblock_vector.limit_memory( bytes, filename_ ); }
   void make_blank()
     { sblock_vector.clear();
       sblock_vector.push_back( Sblock( 0, -1, Sblock::non_tried ) ); }
+  void make_from_list( std::vector< long long > & blocks, const int hardbs,
+                       const Domain & domain, const Sblock::Status type1,
+                       const Sblock::Status type2 );
   bool read_logfile( const int default_sblock_status = 0 );
+  bool binary() const { return binary_; }
+  void binary( const bool b ) { binary_ = b; }
   int write_logfile( FILE * f = 0, const bool timestamp = false ) const;
+  bool replace_logfile( const bool timestamp = false ) const;
+  std::string journal_name() const
+    { return std::string( filename_ ) + ".journal"; }
+  void start_journal() { journaling_ = true; rewrite_needed_ = true; }
+  bool journaling() const { return journaling_; }
+  bool journal_full() const		// compaction needed
+    { return ( rewrite_needed_ || journal_size_ > 64LL * sblocks() + 65536 ); }
+  bool append_journal() const;
 
   bool blank() const;
   long long current_pos() const { return current_pos_; }
@@ -222,19 +408,28 @@ public:
 
   Block extent() const
     { if( sblock_vector.empty() ) return Block( 0, 0 );
-      return Block( sblock_vector.front().pos(),
-                    sblock_vector.back().end() - sblock_vector.front().pos() ); }
-  const Sblock & sblock( const int i ) const { return sblock_vector[i]; }
+      return Block( sblock_vector.pos( 0 ),
+                    sblock_vector.end() - sblock_vector.pos( 0 ) ); }
+  Sblock sblock( const int i ) const { return sblock_vector[i]; }
   int sblocks() const { return (int)sblock_vector.size(); }
+  int find_sblock( const int i, const Sblock::Status st ) const
+    { return sblock_vector.find_status( i, st ); }
+  long long status_size( const Sblock::Status st ) const
+    { return sblock_vector.status_size( st ); }
+  int status_count( const Sblock::Status st ) const
+    { return sblock_vector.status_count( st ); }
+  int status_runs( const Sblock::Status st ) const
+    { return sblock_vector.status_runs( st ); }
   void change_sblock_status( const int i, const Sblock::Status st )
-    { sblock_vector[i].status( st ); }
+    { sblock_vector.status( i, st ); rewrite_needed_ = true; }
 
   void split_by_domain_borders( const Domain & domain );
-  void split_by_logfile_borders( const Logfile & logfile );
+  void split_by_logfile_borders( const Logfile & logfile )
+    { sblock_vector.split_by( logfile.sblock_vector ); }
   bool try_split_sblock_by( const long long pos, const int i )
     {
     if( sblock_vector[i].strictly_includes( pos ) )
-      { insert_sblock( i, sblock_vector[i].split( pos ) ); return true; }
+      { sblock_vector.split( i, pos ); return true; }
     return false;
     }
 
@@ -254,6 +449,75 @@ public:
   };
 
 
+// Reads the sblocks of a logfile one at a time, joined as by
+// 'compact_sblock_vector', without keeping the logfile in memory.
+// A logfile with a journal is read whole into a Logfile instead, because
+// the journal may change any part of it.
+//
+class Logfile_reader
+  {
+  struct Source;			// file being read, defined in logfile.cc
+  Source * source;
+  Logfile logfile;			// used only if there is a journal
+  const int default_sblock_status;
+  int index;				// next sblock of logfile
+  long long current_pos_;
+  Logfile::Status current_status_;
+  bool binary_;
+  bool pending;				// there is a next sblock
+  long long next_pos;			// position and status of next sblock
+  Sblock::Status next_status;
+  long long first_pos, end;		// extent of the sblocks read
+  int sblocks_;				// sblocks returned
+
+  Logfile_reader( const Logfile_reader & );	// declared as private
+  void operator=( const Logfile_reader & );	// declared as private
+
+public:
+  explicit Logfile_reader( const char * const logname,
+                           const int default_sblock_status = 0 );
+  ~Logfile_reader();
+
+  bool open();
+  bool next( Sblock & sb );
+
+  const char * filename() const { return logfile.filename(); }
+  long long current_pos() const { return current_pos_; }
+  Logfile::Status current_status() const { return current_status_; }
+  bool binary() const { return binary_; }
+  Block extent() const { return Block( first_pos, end - first_pos ); }
+  int sblocks() const { return sblocks_; }
+  };
+
+
+// Writes a logfile whose sblocks are produced one at a time, joining
+// consecutive sblocks of the same status. The sblocks are spooled to a
+// temporary file until 'write' is called, so that nothing is written to
+// the output if the sblocks can't be produced.
+//
+class Logfile_writer
+  {
+  FILE * const spool;
+  Sblock last;				// last sblock added, not yet spooled
+  long long records;			// sblocks spooled
+  unsigned crc;				// of the sblocks spooled
+  bool pending;				// last is valid
+
+  Logfile_writer( const Logfile_writer & );	// declared as private
+  void operator=( const Logfile_writer & );	// declared as private
+
+  void spool_last();
+
+public:
+  Logfile_writer();
+  ~Logfile_writer();
+
+  void add( const Sblock & sb );
+  bool write( FILE * const f, const long long current_pos,
+              const Logfile::Status current_status, const bool binary );
+  };
+
+
 // Defined in main_common.cc
 //
 extern int verbosity;
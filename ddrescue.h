@@ -15,6 +15,8 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+class Logfile_saver;
+
 class Logbook : public Logfile
   {
   const long long offset_;		// outfile offset (opos - ipos);
@@ -22,9 +24,11 @@ class Logbook : public Logfile
   Domain & domain_;			// rescue domain
   uint8_t *iobuf_base, *iobuf_;		// iobuf is aligned to page and hardbs
   const int hardbs_, softbs_;
+  int alignment_;			// alignment of iobuf, or 0
   const char * final_msg_;
   int final_errno_;
   long ul_t1;				// variable for update_logfile
+  Logfile_saver * saver_;		// background saver of logfile, or 0
   bool logfile_exists_;
 
   Logbook( const Logbook & );		// declared as private
@@ -33,21 +37,25 @@ class Logbook : public Logfile
 public:
   Logbook( const long long offset, const long long isize, Domain & dom,
            const char * const logname, const int cluster,
-           const int hardbs, const bool complete_only );
+           const int hardbs, const int min_alignment,
+           const bool complete_only, const long long max_map_memory );
   ~Logbook() { delete[] iobuf_base; }
 
+  bool logfile_due( const bool force = false );
   bool update_logfile( const int odes = -1, const bool force = false );
 
   const Domain & domain() const { return domain_; }
   uint8_t * iobuf() const { return iobuf_; }
   int hardbs() const { return hardbs_; }
   int softbs() const { return softbs_; }
+  int alignment() const { return alignment_; }
   long long offset() const { return offset_; }
   const char * final_msg() const { return final_msg_; }
   int final_errno() const { return final_errno_; }
   bool logfile_exists() const { return logfile_exists_; }
   long long logfile_isize() const { return logfile_isize_; }
 
+  void logfile_saver( Logfile_saver * const s ) { saver_ = s; }
   void final_msg( const char * const msg, const int e = 0 )
     { final_msg_ = msg; final_errno_ = e; }
 
@@ -71,6 +79,33 @@ struct Fb_options
   };
 
 
+// Decides when to sync the output file in synchronous mode. By default
+// it is synced after every write. With '--group-commit' it is synced
+// once 'max_bytes' have been written, or 'max_ms' milliseconds have
+// passed, since the last sync. The logfile is safe in both cases because
+// update_logfile syncs the output file before writing the logfile.
+//
+class Group_commit
+  {
+  static long long max_bytes_;
+  static long max_ms_;
+  long long pending_bytes;		// written since last sync
+  long long last_sync;			// time of last sync in ms, or -1
+
+public:
+  Group_commit() : pending_bytes( 0 ), last_sync( -1 ) {}
+
+  static void set_limits( const long long max_bytes, const long max_ms )
+    { max_bytes_ = max_bytes; max_ms_ = max_ms; }
+  static long long max_bytes() { return max_bytes_; }
+  static long max_ms() { return max_ms_; }
+
+  // Both return false if the sync fails.
+  bool written( const int fd, const long long size );
+  bool sync( const int fd );
+  };
+
+
 class Fillbook : public Logbook, public Fb_options
   {
   long long filled_size;		// size already filled
@@ -79,12 +114,14 @@ class Fillbook : public Logbook, public Fb_options
   int remaining_areas;			// areas to be filled
   int odes_;				// output file descriptor
   const bool synchronous_;
+  Group_commit commit;
 					// variables for show_status
   long long a_rate, c_rate, first_size, last_size;
   long long last_ipos;
   long t0, t1;				// start, current times
   int oldlen;
 
+  int next_fill_index( const int i, const std::string & filltypes ) const;
   int fill_areas( const std::string & filltypes );
   int fill_block( const Sblock & sb );
   void show_status( const long long ipos, const char * const msg = 0,
@@ -94,7 +131,7 @@ public:
   Fillbook( const long long offset, Domain & dom,
             const char * const logname, const int cluster, const int hardbs,
             const Fb_options & fb_opts, const bool synchronous )
-    : Logbook( offset, 0, dom, logname, cluster, hardbs, true ),
+    : Logbook( offset, 0, dom, logname, cluster, hardbs, 0, true, 0 ),
       Fb_options( fb_opts ),
       synchronous_( synchronous ),
       a_rate( 0 ), c_rate( 0 ), first_size( 0 ), last_size( 0 ),
@@ -124,7 +161,7 @@ public:
   Genbook( const long long offset, const long long isize,
            Domain & dom, const char * const logname,
            const int cluster, const int hardbs )
-    : Logbook( offset, isize, dom, logname, cluster, hardbs, false ),
+    : Logbook( offset, isize, dom, logname, cluster, hardbs, 0, false, 0 ),
       a_rate( 0 ), c_rate( 0 ), first_size( 0 ), last_size( 0 ),
       last_ipos( 0 ), t0( 0 ), t1( 0 ), oldlen( 0 )
       {}
@@ -135,11 +172,17 @@ public:
 
 #include "sliding_avg.h"
 
+class Block_writer;
+struct Stripe;
+struct Stripe_set;
+class Uring_reader;
+
 struct Rb_options
   {
   enum { default_skipbs = 65536, max_max_skipbs = 1 << 30 };
 
   long long max_error_rate;
+  long long max_map_memory;	// memory for the map of sblocks. 0 = all
   long long min_outfile_size;
   long long max_read_rate;
   long long min_read_rate;
@@ -148,13 +191,19 @@ struct Rb_options
   int cpass_bitset;		// 1 | 2 | 4 for passes 1, 2, 3
   int max_errors;
   int max_retries;
+  int min_copybs;		// minimum size of copy blocks. 0 = fixed size
   int o_direct_in;		// O_DIRECT or 0
   int o_direct_out;		// O_DIRECT or 0
   int preview_lines;		// preview lines to show. 0 = disable
   int skipbs;			// initial size to skip on read error
   int max_skipbs;		// maximum size to skip on read error
+  int threads;			// threads reading in pass 1. 1 = disable
+  int uring_depth;		// reads queued through io_uring. 0 = disable
+  int write_buffers;		// buffers for the writer thread. 0 = disable
   bool complete_only;
+  bool async_logfile;		// save logfile from a separate thread
   bool exit_on_error;
+  bool journal;			// append changes to a journal file
   bool new_errors_only;
   bool noscrape;
   bool notrim;
@@ -164,36 +213,47 @@ struct Rb_options
   bool sparse;
   bool try_again;
   bool unidirectional;
+  bool zero_copy;		// copy in kernel with copy_file_range
 
   Rb_options()
-    : max_error_rate( -1 ), min_outfile_size( -1 ), max_read_rate( 0 ),
+    : max_error_rate( -1 ), max_map_memory( 0 ), min_outfile_size( -1 ), max_read_rate( 0 ),
       min_read_rate( -1 ), pause( 0 ), timeout( -1 ), cpass_bitset( 7 ),
-      max_errors( -1 ), max_retries( 0 ), o_direct_in( 0 ), o_direct_out( 0 ),
-      preview_lines( 0 ), skipbs( default_skipbs ), max_skipbs( max_max_skipbs ),
-      complete_only( false ), exit_on_error( false ),
-      new_errors_only( false ), noscrape( false ), notrim( false ),
+      max_errors( -1 ), max_retries( 0 ), min_copybs( 0 ), o_direct_in( 0 ),
+      o_direct_out( 0 ), preview_lines( 0 ), skipbs( default_skipbs ),
+      max_skipbs( max_max_skipbs ), threads( 1 ), uring_depth( 0 ),
+      write_buffers( 0 ), complete_only( false ), async_logfile( false ),
+      exit_on_error( false ),
+      journal( false ), new_errors_only( false ), noscrape( false ), notrim( false ),
       reopen_on_error( false ), retrim( false ), reverse( false ),
-      sparse( false ), try_again( false ), unidirectional( false )
+      sparse( false ), try_again( false ), unidirectional( false ),
+      zero_copy( false )
       {}
 
   bool operator==( const Rb_options & o ) const
     { return ( max_error_rate == o.max_error_rate &&
+               max_map_memory == o.max_map_memory &&
                min_outfile_size == o.min_outfile_size &&
                max_read_rate == o.max_read_rate &&
                min_read_rate == o.min_read_rate && pause == o.pause &&
                timeout == o.timeout && cpass_bitset == o.cpass_bitset &&
                max_errors == o.max_errors && max_retries == o.max_retries &&
+               min_copybs == o.min_copybs &&
                o_direct_in == o.o_direct_in && o_direct_out == o.o_direct_out &&
                preview_lines == o.preview_lines &&
                skipbs == o.skipbs && max_skipbs == o.max_skipbs &&
+               threads == o.threads &&
+               uring_depth == o.uring_depth &&
+               write_buffers == o.write_buffers &&
                complete_only == o.complete_only &&
-               exit_on_error == o.exit_on_error &&
+               async_logfile == o.async_logfile &&
+               exit_on_error == o.exit_on_error && journal == o.journal &&
                new_errors_only == o.new_errors_only &&
                noscrape == o.noscrape && notrim == o.notrim &&
                reopen_on_error == o.reopen_on_error &&
                retrim == o.retrim && reverse == o.reverse &&
                sparse == o.sparse && try_again == o.try_again &&
-               unidirectional == o.unidirectional ); }
+               unidirectional == o.unidirectional &&
+               zero_copy == o.zero_copy ); }
   bool operator!=( const Rb_options & o ) const
     { return !( *this == o ); }
   };
@@ -211,9 +271,19 @@ class Rescuebook : public Logbook, public Rb_options
   int errors;				// error areas found so far
   int ides_, odes_;			// input and output file descriptors
   const bool synchronous_;
+  Group_commit commit;
+  int copybs;				// current size of copy blocks
+  long copybs_t;			// time of last change of copybs
 					// variables for update_rates
   long long a_rate, c_rate, first_size, last_size;
   long long iobuf_ipos;			// last pos read in iobuf, or -1
+  long long ra_pos;			// next pos to queue for read, or -1
+  bool ra_stopped;			// no reads queued since last error
+  Uring_reader * uring;			// queue of asynchronous reads
+  Block_writer * writer;		// writer thread for the copying passes
+  Logfile_saver * saver;		// saver thread for the logfile
+  Block hole_cache, data_cache;		// last areas of input file found
+  bool seek_holes;			// look for holes in input file
   long long last_ipos;
   long t0, t1, ts;			// start, current, last successful
   int oldlen;
@@ -223,8 +293,15 @@ class Rescuebook : public Logbook, public Rb_options
   bool just_paused;			// variable for update_and_pause
 
   bool extend_outfile_size();
-  int copy_block( const Block & b, int & copied_size, int & error_size );
+  Block input_hole( const long long pos );
+  void extend_to_hole( Block & b );
+  int copy_hole( const Block & b, int & copied_size, int & error_size );
+  int copy_block( const Block & b, int & copied_size, int & error_size,
+                  bool & write_queued );
+  int reap_writes( const bool drain );
   void count_errors();
+  void replace_status( const Sblock::Status old_st,
+                       const Sblock::Status new_st );
   bool errors_or_timeout()
     { if( max_errors >= 0 && errors > max_errors ) e_code |= 2;
       return ( e_code != 0 ); }
@@ -239,11 +316,14 @@ class Rescuebook : public Logbook, public Rb_options
                        int & error_size, const char * const msg,
                        const Status curr_st, const bool forward,
                        const Sblock::Status st = Sblock::bad_sector );
+  void queue_reads( const Block & b, const bool forward );
+  void adapt_copybs( const int error_size );
   bool reopen_infile();
   bool update_and_pause();
   int copy_non_tried();
   int fcopy_non_tried( const char * const msg, const int pass );
   int rcopy_non_tried( const char * const msg, const int pass );
+  int tcopy_non_tried( const char * const msg );
   int trim_errors();
   int scrape_errors();
   int copy_errors();
@@ -257,9 +337,14 @@ public:
               Domain & dom, const Domain * const test_dom,
               const Rb_options & rb_opts, const char * const iname,
               const char * const logname, const int cluster,
-              const int hardbs, const bool synchronous );
+              const int hardbs, const int min_alignment,
+              const bool synchronous );
+  ~Rescuebook();
 
   int do_rescue( const int ides, const int odes );
+  void add_stripe_counters( Stripe_set & set );
+  void copy_stripe( Stripe & s );		// run by each thread of tcopy
+
   };
 
 
@@ -28,9 +28,11 @@
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
+#include <functional>
 #include <string>
 #include <vector>
 #include <stdint.h>
+#include <unistd.h>
 
 #include "arg_parser.h"
 #include "block.h"
@@ -42,8 +44,13 @@ const char * const Program_name = "GNU ddrescuelog";
 const char * const program_name = "ddrescuelog";
 const char * invocation_name = 0;
 
-enum Mode { m_none, m_and, m_change, m_compare, m_complete, m_create,
-            m_delete, m_done_st, m_invert, m_list, m_or, m_status, m_xor };
+enum Mode { m_none, m_and, m_change, m_compare, m_complete, m_convert,
+            m_create, m_delete, m_done_st, m_invert, m_list, m_merge, m_or,
+            m_status, m_xor };
+enum Merge_op { merge_or, merge_and, merge_best };
+
+// Block status characters in order of increasing rescue progress.
+const char * const progress_order = "?*/-+";
 
 
 void show_help( const int hardbs )
@@ -78,6 +85,9 @@ void show_help( const int hardbs )
                "  -x, --xor-logfile=<file>        XOR the finished blocks in file with logfile\n"
                "  -y, --and-logfile=<file>        AND the finished blocks in file with logfile\n"
                "  -z, --or-logfile=<file>         OR the finished blocks in file with logfile\n"
+               "      --merge[=<op>]              merge logfiles by or, and, or best status [or]\n"
+               "      --to-binary                 convert logfile to binary format\n"
+               "      --to-text                   convert logfile to text format\n"
                "Numbers may be in decimal, hexadecimal or octal, and may be followed by a\n"
                "multiplier: s = sectors, k = 1000, Ki = 1024, M = 10^6, Mi = 2^20, etc...\n"
                "\nExit status: 0 for a normal exit, 1 for environmental problems (file\n"
@@ -147,55 +157,249 @@ void parse_type( const std::string & arg, Sblock::Status & complete_type )
   }
 
 
+void parse_merge_op( const std::string & arg, Merge_op & merge_op )
+  {
+  if( arg.empty() || arg == "or" ) merge_op = merge_or;
+  else if( arg == "and" ) merge_op = merge_and;
+  else if( arg == "best" ) merge_op = merge_best;
+  else
+    {
+    show_error( "Invalid operation for 'merge' option.", 0, true );
+    std::exit( 1 );
+    }
+  }
+
+
+// Returns the parts of the sblocks of a logfile that are inside the
+// domain, splitting the sblocks at the borders of the domain.
+//
+class Domain_splitter
+  {
+  Logfile_reader & reader;
+  const Domain & domain;
+  Sblock sb;				// rest of the sblock being split
+  int i;				// first domain block not before sb
+
+public:
+  Domain_splitter( Logfile_reader & r, const Domain & d )
+    : reader( r ), domain( d ), sb( 0, 0, Sblock::non_tried ), i( 0 ) {}
+
+  // Returns false at the end of the logfile.
+  bool next( Sblock & part, const bool finished_only = false )
+    {
+    while( true )
+      {
+      if( sb.size() <= 0 )
+        {
+        if( !reader.next( sb ) ) return false;
+        if( sb.size() <= 0 )
+          {
+          if( domain.includes( sb ) &&
+              ( !finished_only || sb.status() == Sblock::finished ) )
+            { part = sb; return true; }
+          continue;
+          }
+        }
+      while( i < domain.blocks() && domain.block( i ).end() <= sb.pos() ) ++i;
+      if( i >= domain.blocks() || domain.block( i ).pos() >= sb.end() ||
+          ( finished_only && sb.status() != Sblock::finished ) )
+        { sb.size( 0 ); continue; }
+      const Block & db = domain.block( i );
+      if( sb.pos() < db.pos() ) sb.assign( db.pos(), sb.end() - db.pos() );
+      const long long end = std::min( sb.end(), db.end() );
+      part = Sblock( sb.pos(), end - sb.pos(), sb.status() );
+      sb.assign( end, sb.end() - end );
+      return true;
+      }
+    }
+  };
+
+
+// Reads both logfiles at the same time, writing each part of the first
+// logfile as soon as the corresponding part of the second one is known.
+// Memory use does not depend on the size of the logfiles.
+//
 int do_logic_ops( Domain & domain, const char * const logname,
                   const char * const second_logname, const Mode program_mode )
   {
-  Logfile logfile( logname );
-  if( !logfile.read_logfile() ) return not_readable( logname );
-  logfile.compact_sblock_vector();
-
-  Logfile logfile2( second_logname );
-  if( !logfile2.read_logfile() ) return not_readable( second_logname );
-  logfile2.compact_sblock_vector();
+  Logfile_reader reader( logname );
+  if( !reader.open() ) return not_readable( logname );
+  Logfile_reader reader2( second_logname );
+  if( !reader2.open() ) return not_readable( second_logname );
+
+  Logfile_writer writer;
+  Sblock sb1( 0, 0, Sblock::non_tried ), sb2( sb1 );
+  bool valid2 = reader2.next( sb2 );
+  int i = 0;				// first domain block not before pos
+  while( reader.next( sb1 ) )
+    {
+    long long pos = sb1.pos();
+    do {		// split sb1 at the borders of sb2 and of the domain
+      while( valid2 && sb2.end() <= pos ) valid2 = reader2.next( sb2 );
+      while( i < domain.blocks() && domain.block( i ).end() <= pos ) ++i;
+      long long end = sb1.end();
+      bool in2 = false, in_domain = false;
+      if( valid2 )
+        {
+        if( sb2.pos() > pos ) end = std::min( end, sb2.pos() );
+        else { end = std::min( end, sb2.end() ); in2 = true; }
+        }
+      if( i < domain.blocks() )
+        {
+        const Block & db = domain.block( i );
+        if( db.pos() > pos ) end = std::min( end, db.pos() );
+        else { end = std::min( end, db.end() ); in_domain = true; }
+        }
+      Sblock sb( pos, end - pos, sb1.status() );
+      if( in2 && in_domain && end > pos )
+        {
+        const bool f1 = ( sb1.status() == Sblock::finished );
+        const bool f2 = ( sb2.status() == Sblock::finished );
+        switch( program_mode )
+          {
+          case m_and:
+            if( f1 && !f2 ) sb.status( Sblock::bad_sector );
+            break;
+          case m_or:
+            if( !f1 && f2 ) sb.status( Sblock::finished );
+            break;
+          case m_xor:
+            if( f2 ) sb.status( f1 ? Sblock::bad_sector : Sblock::finished );
+            break;
+          default: internal_error( "invalid program_mode." );
+          }
+        }
+      writer.add( sb );
+      pos = end;
+      }
+    while( pos < sb1.end() );
+    }
+  while( valid2 ) valid2 = reader2.next( sb2 );	// check the rest of file
 
-  domain.crop( logfile.extent() );
-  domain.crop( logfile2.extent() );
+  domain.crop( reader.extent() );
+  domain.crop( reader2.extent() );
   if( domain.empty() ) return empty_domain();
-  logfile.split_by_domain_borders( domain );
-  logfile2.split_by_domain_borders( domain );
-  logfile.split_by_logfile_borders( logfile2 );
-  logfile2.split_by_logfile_borders( logfile );
+  if( !writer.write( stdout, reader.current_pos(), reader.current_status(),
+                     reader.binary() ) )
+    { show_error( "Write error", errno ); return 1; }
+  if( std::fclose( stdout ) != 0 )
+    { show_error( "Can't close stdout", errno ); return 1; }
+  return 0;
+  }
+
+
+int progress( const Sblock::Status st )
+  { return std::strchr( progress_order, st ) - progress_order; }
+
 
-  for( int i = 0, j = 0; ; ++i, ++j )
+// Merges any number of logfiles in a single pass. The first logfile is
+// walked sblock by sblock; the other ones are kept in a heap ordered by
+// the position of their next border, and the statuses of the sblocks
+// covering the current position are counted, so that each part of the
+// first logfile is merged in constant time. Total time is proportional
+// to the number of sblocks read, times the log of the number of logfiles.
+//
+int merge_logfiles( Domain & domain, const std::vector< const char * > & lognames,
+                    const Merge_op merge_op )
+  {
+  const int logfiles = lognames.size();
+  std::vector< Logfile_reader * > readers;
+  for( int k = 0; k < logfiles; ++k )
     {
-    while( i < logfile.sblocks() && !domain.includes( logfile.sblock( i ) ) )
-      ++i;
-    while( j < logfile2.sblocks() && !domain.includes( logfile2.sblock( j ) ) )
-      ++j;
-    if( i >= logfile.sblocks() || j >= logfile2.sblocks() ) break;
-    const Sblock & sb1 = logfile.sblock( i );
-    const Sblock & sb2 = logfile2.sblock( j );
-    if( sb1.pos() != sb2.pos() || sb1.size() != sb2.size() )
-      internal_error( "blocks got out of sync." );
-    const bool f1 = ( sb1.status() == Sblock::finished );
-    const bool f2 = ( sb2.status() == Sblock::finished );
-    switch( program_mode )
+    readers.push_back( new Logfile_reader( lognames[k] ) );
+    if( !readers.back()->open() )
       {
-      case m_and:
-        if( f1 && !f2 ) logfile.change_sblock_status( i, Sblock::bad_sector );
-        break;
-      case m_or:
-        if( !f1 && f2 ) logfile.change_sblock_status( i, Sblock::finished );
-        break;
-      case m_xor:
-        if( f1 != ( ( f1 || f2 ) && !( f1 && f2 ) ) )
-          logfile.change_sblock_status( i, f1 ? Sblock::bad_sector : Sblock::finished );
-        break;
-      default: internal_error( "invalid program_mode." );
+      for( int j = 0; j <= k; ++j ) delete readers[j];
+      return not_readable( lognames[k] );
       }
     }
-  logfile.compact_sblock_vector();
-  logfile.write_logfile( stdout );
+  Logfile_reader & reader = *readers[0];
+
+  // sblocks[k] is the current sblock of logfile k, which is counted in
+  // 'counts' while it covers the current position.
+  std::vector< Sblock > sblocks( logfiles, Sblock( 0, 0, Sblock::non_tried ) );
+  std::vector< bool > active( logfiles, false );
+  typedef std::pair< long long, int > Border;	// position, logfile
+  std::vector< Border > heap;			// borders, nearest first
+  int counts[5] = { 0, 0, 0, 0, 0 };		// active sblocks by progress
+  for( int k = 1; k < logfiles; ++k )
+    if( readers[k]->next( sblocks[k] ) )
+      heap.push_back( Border( sblocks[k].pos(), k ) );
+  std::make_heap( heap.begin(), heap.end(), std::greater< Border >() );
+
+  Logfile_writer writer;
+  Sblock sb1( 0, 0, Sblock::non_tried );
+  int i = 0;				// first domain block not before pos
+  while( reader.next( sb1 ) )
+    {
+    long long pos = sb1.pos();
+    do {		// split sb1 at the borders of the other logfiles
+      while( !heap.empty() && heap.front().first <= pos )
+        {
+        std::pop_heap( heap.begin(), heap.end(), std::greater< Border >() );
+        const int k = heap.back().second;
+        heap.pop_back();
+        Sblock & sb = sblocks[k];
+        if( active[k] || sb.size() <= 0 )	// sb ends here; get the next
+          {
+          if( active[k] )
+            { --counts[progress( sb.status() )]; active[k] = false; }
+          if( !readers[k]->next( sb ) ) continue;
+          }
+        if( sb.size() > 0 && sb.pos() <= pos )	// sb begins here
+          { ++counts[progress( sb.status() )]; active[k] = true; }
+        heap.push_back( Border( active[k] ? sb.end() : sb.pos(), k ) );
+        std::push_heap( heap.begin(), heap.end(), std::greater< Border >() );
+        }
+      while( i < domain.blocks() && domain.block( i ).end() <= pos ) ++i;
+      long long end = sb1.end();
+      bool in_domain = false;
+      if( !heap.empty() ) end = std::min( end, heap.front().first );
+      if( i < domain.blocks() )
+        {
+        const Block & db = domain.block( i );
+        if( db.pos() > pos ) end = std::min( end, db.pos() );
+        else { end = std::min( end, db.end() ); in_domain = true; }
+        }
+      Sblock sb( pos, end - pos, sb1.status() );
+      if( in_domain && end > pos )
+        {
+        const bool f1 = ( sb1.status() == Sblock::finished );
+        const int finished = counts[progress( Sblock::finished )];
+        int others = 0;
+        for( int j = 0; j < 5; ++j ) others += counts[j];
+        switch( merge_op )
+          {
+          case merge_or:
+            if( !f1 && finished > 0 ) sb.status( Sblock::finished );
+            break;
+          case merge_and:
+            if( f1 && finished < others ) sb.status( Sblock::bad_sector );
+            break;
+          case merge_best:
+            for( int j = 4; j > progress( sb1.status() ); --j )
+              if( counts[j] > 0 )
+                { sb.status( Sblock::Status( progress_order[j] ) ); break; }
+            break;
+          }
+        }
+      writer.add( sb );
+      pos = end;
+      }
+    while( pos < sb1.end() );
+    }
+  for( int k = 1; k < logfiles; ++k )		// check the rest of files
+    while( readers[k]->next( sblocks[k] ) ) {}
+
+  domain.crop( reader.extent() );
+  const bool empty = domain.empty();
+  bool error = false;
+  if( !empty )
+    error = !writer.write( stdout, reader.current_pos(),
+                           reader.current_status(), reader.binary() );
+  for( int k = 0; k < logfiles; ++k ) delete readers[k];
+  if( empty ) return empty_domain();
+  if( error ) { show_error( "Write error", errno ); return 1; }
   if( std::fclose( stdout ) != 0 )
     { show_error( "Can't close stdout", errno ); return 1; }
   return 0;
@@ -211,10 +415,11 @@ int change_types( Domain & domain, const char * const logname,
   if( domain.empty() ) return empty_domain();
   logfile.split_by_domain_borders( domain );
 
+  int dcursor = 0;			// cursor for domain lookups
   for( int i = 0; i < logfile.sblocks(); ++i )
     {
     const Sblock & sb = logfile.sblock( i );
-    if( !domain.includes( sb ) )
+    if( !domain.includes( sb, dcursor ) )
       { if( domain < sb ) break; else continue; }
     const unsigned j = types1.find( sb.status() );
     if( j < types1.size() )
@@ -228,59 +433,41 @@ int change_types( Domain & domain, const char * const logname,
   }
 
 
-int set_for_compare( Domain & domain, Logfile & logfile,
-                     const bool as_domain, const bool loose )
-  {
-  if( !logfile.read_logfile( ( as_domain && loose ) ? '?' : 0 ) )
-    return not_readable( logfile.filename() );
-  logfile.compact_sblock_vector();
-  domain.crop( logfile.extent() );
-  if( domain.empty() ) return empty_domain();
-  logfile.split_by_domain_borders( domain );
-  return -1;
-  }
-
 int compare_logfiles( Domain & domain, const char * const logname,
                       const char * const second_logname,
                       const bool as_domain, const bool loose )
   {
-  Domain domain2( domain );
-  Logfile logfile( logname );
-  int retval = set_for_compare( domain, logfile, as_domain, loose );
-  if( retval >= 0 ) return retval;
-
-  Logfile logfile2( second_logname );
-  retval = set_for_compare( domain2, logfile2, as_domain, loose );
-  if( retval >= 0 ) return retval;
-
-  retval = 0;
-  if( !as_domain && domain != domain2 ) retval = 1;
-  else
+  const int default_sblock_status = ( as_domain && loose ) ? '?' : 0;
+  Logfile_reader reader( logname, default_sblock_status );
+  if( !reader.open() ) return not_readable( logname );
+  Logfile_reader reader2( second_logname, default_sblock_status );
+  if( !reader2.open() ) return not_readable( second_logname );
+
+  bool differ = false;
+  Domain_splitter splitter( reader, domain ), splitter2( reader2, domain );
+  while( true )
     {
-    int i = 0, j = 0;
-    while( true )
-      {
-      while( i < logfile.sblocks() &&
-             ( !domain.includes( logfile.sblock( i ) ) ||
-             ( as_domain && logfile.sblock( i ).status() != Sblock::finished ) ) )
-        ++i;
-      while( j < logfile2.sblocks() &&
-             ( !domain2.includes( logfile2.sblock( j ) ) ||
-             ( as_domain && logfile2.sblock( j ).status() != Sblock::finished ) ) )
-        ++j;
-      if( ( i < logfile.sblocks() ) != ( j < logfile2.sblocks() ) )
-        { retval = 1; break; }			// one file has more blocks
-      if( i >= logfile.sblocks() ) break;	// successful compare
-      if( logfile.sblock( i++ ) != logfile2.sblock( j++ ) )
-        { retval = 1; break; }
-      }
+    Sblock sb1( 0, 0, Sblock::non_tried ), sb2( sb1 );
+    const bool valid1 = splitter.next( sb1, as_domain );
+    const bool valid2 = splitter2.next( sb2, as_domain );
+    if( !valid1 && !valid2 ) break;		// both files read
+    if( valid1 != valid2 || sb1 != sb2 ) differ = true;
     }
-  if( retval )
+
+  Domain domain2( domain );
+  domain.crop( reader.extent() );
+  if( domain.empty() ) return empty_domain();
+  domain2.crop( reader2.extent() );
+  if( domain2.empty() ) return empty_domain();
+
+  int retval = 0;
+  if( differ || ( !as_domain && domain != domain2 ) )
     {
     char buf[80];
     snprintf( buf, sizeof buf, "Logfiles '%s' and '%s' differ.",
-              logfile.filename(), logfile2.filename() );
+              reader.filename(), reader2.filename() );
     show_error( buf );
+    retval = 1;
     }
   return retval;
   }
@@ -299,6 +486,22 @@ int complete_logfile( const char * const logname,
   }
 
 
+int convert_logfile( const char * const logname, const bool to_binary )
+  {
+  Logfile logfile( logname );
+  if( !logfile.read_logfile() ) return not_readable( logname );
+  if( to_binary && isatty( STDOUT_FILENO ) )
+    { show_error( "I won't write binary data to a terminal.", 0, true );
+      return 1; }
+  logfile.binary( to_binary );
+  if( !logfile.write_logfile( stdout ) )
+    { show_error( "Write error", errno ); return 1; }
+  if( std::fclose( stdout ) != 0 )
+    { show_error( "Can't close stdout", errno ); return 1; }
+  return 0;
+  }
+
+
 int create_logfile( Domain & domain, const char * const logname,
                     const int hardbs, const Sblock::Status type1,
                     const Sblock::Status type2, const bool force )
@@ -313,13 +516,9 @@ int create_logfile( Domain & domain, const char * const logname,
     return 1;
     }
   if( domain.empty() ) return empty_domain();
-  logfile.make_blank();
-  logfile.split_by_domain_borders( domain );
 
-  for( int i = 0; i < logfile.sblocks(); ++i )	// mark all logfile as type2
-    logfile.change_sblock_status( i, type2 );
-
-  // mark every block read from stdin and in domain as type1
+  // read the block numbers from stdin, then mark as type1 those in domain
+  std::vector< long long > blocks;
   for( int linenum = 1; ; ++linenum )
     {
     long long block;
@@ -332,11 +531,9 @@ int create_logfile( Domain & domain, const char * const logname,
       show_error( buf );
       return 2;
       }
-    const Block b( block * hardbs, hardbs );
-    if( domain.includes( b ) )
-      logfile.change_chunk_status( b, type1, domain );
+    blocks.push_back( block );
     }
-  logfile.truncate_vector( domain.end(), true );
+  logfile.make_from_list( blocks, hardbs, domain, type1, type2 );
   if( !logfile.write_logfile() ) return 1;
   return 0;
   }
@@ -351,10 +548,11 @@ int test_if_done( Domain & domain, const char * const logname, const bool del )
   if( domain.empty() ) return empty_domain();
   logfile.split_by_domain_borders( domain );
 
+  int dcursor = 0;			// cursor for domain lookups
   for( int i = 0; i < logfile.sblocks(); ++i )
     {
     const Sblock & sb = logfile.sblock( i );
-    if( !domain.includes( sb ) )
+    if( !domain.includes( sb, dcursor ) )
       { if( domain < sb ) break; else continue; }
     if( sb.status() != Sblock::finished )
       {
@@ -393,10 +591,11 @@ int to_badblocks( const long long offset, Domain & domain,
   if( domain.empty() ) return empty_domain();
   logfile.split_by_domain_borders( domain );
 
+  int dcursor = 0;			// cursor for domain lookups
   for( int i = 0; i < logfile.sblocks(); ++i )
     {
     const Sblock & sb = logfile.sblock( i );
-    if( !domain.includes( sb ) )
+    if( !domain.includes( sb, dcursor ) )
       { if( domain < sb ) break; else continue; }
     if( blocktypes.find( sb.status() ) >= blocktypes.size() ) continue;
     for( long long block = ( sb.pos() + offset ) / hardbs;
@@ -463,20 +662,13 @@ int do_show_status( Domain & domain, const char * const logname )
   long long size_bad_sector = 0, size_finished = 0;
   int areas_non_tried = 0, areas_non_trimmed = 0, areas_non_scraped = 0;
   int areas_bad_sector = 0, areas_finished = 0;
-  Logfile logfile( logname );
-  if( !logfile.read_logfile() ) return not_readable( logname );
-  logfile.compact_sblock_vector();
-  const Block extent = logfile.extent();
-  domain.crop( extent );
-  if( domain.empty() ) return empty_domain();
-  const int true_sblocks = logfile.sblocks();
-  logfile.split_by_domain_borders( domain );
+  Logfile_reader reader( logname );
+  if( !reader.open() ) return not_readable( logname );
 
-  for( int i = 0; i < logfile.sblocks(); ++i )
+  Domain_splitter splitter( reader, domain );
+  Sblock sb( 0, 0, Sblock::non_tried );
+  while( splitter.next( sb ) )
     {
-    const Sblock & sb = logfile.sblock( i );
-    if( !domain.includes( sb ) )
-      { if( domain < sb ) break; else continue; }
     switch( sb.status() )
       {
       case Sblock::non_tried:   size_non_tried += sb.size();
@@ -491,12 +683,16 @@ int do_show_status( Domain & domain, const char * const logname )
                                 ++areas_bad_sector; break;
       }
     }
+  const Block extent = reader.extent();
+  domain.crop( extent );
+  if( domain.empty() ) return empty_domain();
+  const int true_sblocks = reader.sblocks();
 
   const long long domain_size = domain.in_size();
   if( verbosity >= 1 ) std::printf( "\n%s", logname );
   std::printf( "\n   current pos: %10sB,  current status: %s\n",
-               format_num( logfile.current_pos() ),
-               logfile.status_name( logfile.current_status() ) );
+               format_num( reader.current_pos() ),
+               Logfile::status_name( reader.current_status() ) );
   std::printf( "logfile extent: %10sB,  in %6d area(s)\n",
                format_num( extent.size() ), true_sblocks );
   if( domain.pos() > 0 || domain.end() < extent.end() || domain.blocks() > 1 )
@@ -543,14 +739,17 @@ int main( const int argc, const char * const argv[] )
   bool as_domain = false;
   bool force = false;
   bool loose = false;
+  bool to_binary = false;
   std::string types1, types2;
   Sblock::Status type1 = Sblock::finished, type2 = Sblock::bad_sector;
   Sblock::Status complete_type = Sblock::non_tried;
+  Merge_op merge_op = merge_or;
   invocation_name = argv[0];
   command_line = argv[0];
   for( int i = 1; i < argc; ++i )
     { command_line += ' '; command_line += argv[i]; }
 
+  enum Optcode { opt_bin = 256, opt_mrg, opt_txt };
   const Arg_parser::Option options[] =
     {
     { 'a', "change-types",        Arg_parser::yes },
@@ -580,6 +779,9 @@ int main( const int argc, const char * const argv[] )
     { 'x', "xor-logfile",         Arg_parser::yes },
     { 'y', "and-logfile",         Arg_parser::yes },
     { 'z', "or-logfile",          Arg_parser::yes },
+    { opt_bin, "to-binary",       Arg_parser::no  },
+    { opt_mrg, "merge",           Arg_parser::maybe },
+    { opt_txt, "to-text",         Arg_parser::no  },
     {  0 , 0,                     Arg_parser::no  } };
 
   const Arg_parser parser( argc, argv, options );
@@ -627,6 +829,11 @@ int main( const int argc, const char * const argv[] )
                 second_logname = arg; break;
       case 'z': set_mode( program_mode, m_or );
                 second_logname = arg; break;
+      case opt_mrg: set_mode( program_mode, m_merge );
+                    parse_merge_op( arg, merge_op ); break;
+      case opt_bin:
+      case opt_txt: set_mode( program_mode, m_convert );
+                    to_binary = ( code == opt_bin ); break;
       default : internal_error( "uncaught option." );
       }
     } // end process options
@@ -639,7 +846,7 @@ int main( const int argc, const char * const argv[] )
 
   if( opos < 0 ) opos = ipos;
 
-  if( program_mode == m_status )
+  if( program_mode == m_status || program_mode == m_merge )
     {
     if( argind >= parser.arguments() )
       { show_error( "At least one logfile must be specified.", 0, true );
@@ -654,6 +861,15 @@ int main( const int argc, const char * const argv[] )
     return 1;
     }
 
+  if( program_mode == m_merge )
+    {
+    std::vector< const char * > lognames;
+    for( ; argind < parser.arguments(); ++argind )
+      lognames.push_back( parser.argument( argind ).c_str() );
+    Domain domain( ipos, max_size, domain_logfile_name, loose );
+    return merge_logfiles( domain, lognames, merge_op );
+    }
+
   int retval = 0;
   for( ; argind < parser.arguments(); ++argind )
     {
@@ -662,7 +878,8 @@ int main( const int argc, const char * const argv[] )
 
     switch( program_mode )
       {
-      case m_none: internal_error( "invalid operation." ); break;
+      case m_none:
+      case m_merge: internal_error( "invalid operation." ); break;
       case m_and:
       case m_or:
       case m_xor:
@@ -671,6 +888,7 @@ int main( const int argc, const char * const argv[] )
       case m_compare:
         return compare_logfiles( domain, logname, second_logname, as_domain, loose );
       case m_complete: return complete_logfile( logname, complete_type );
+      case m_convert: return convert_logfile( logname, to_binary );
       case m_create: return create_logfile( domain, logname, hardbs,
                                             type1, type2, force );
       case m_delete: return test_if_done( domain, logname, true );
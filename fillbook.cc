@@ -30,17 +30,41 @@
 #include "ddrescue.h"
 
 
+// Returns the index of the first sblock with index >= 'i' and status in
+// 'filltypes', or -1 if there is none.
+//
+int Fillbook::next_fill_index( const int i,
+                               const std::string & filltypes ) const
+  {
+  int next = -1;
+  for( unsigned k = 0; k < filltypes.size(); ++k )
+    {
+    const int j = find_sblock( i, Sblock::Status( filltypes[k] ) );
+    if( j >= 0 && ( next < 0 || j < next ) ) next = j;
+    }
+  return next;
+  }
+
+
 // Return values: 1 write error, 0 OK, -1 interrupted, -2 logfile error.
 //
 int Fillbook::fill_areas( const std::string & filltypes )
   {
   const char * const msg = "Filling blocks...";
   bool first_post = true;
+  // If the domain covers the whole extent, jump to the areas to fill.
+  // Else step through the sblocks checking each one against the domain.
+  const bool whole = domain().includes( extent() );
+  const int start = std::max( find_index( current_pos() ), 0 );
 
-  for( int index = 0; index < sblocks(); ++index )
+  int dcursor = 0;			// cursor for domain lookups
+  for( int index = whole ? next_fill_index( start, filltypes ) : start;
+       index >= 0 && index < sblocks();
+       index = whole ? next_fill_index( index + 1, filltypes ) : index + 1 )
     {
     const Sblock & sb = sblock( index );
-    if( !domain().includes( sb ) ) { if( domain() < sb ) break; else continue; }
+    if( !domain().includes( sb, dcursor ) )
+      { if( domain() < sb ) break; else continue; }
     if( sb.end() <= current_pos() ||
         filltypes.find( sb.status() ) >= filltypes.size() ) continue;
     Block b( sb.pos(), softbs() );	// fill the area a softbs at a time
@@ -128,18 +152,49 @@ int Fillbook::do_fill( const int odes, const std::string & filltypes )
   if( current_status() != filling || !domain().includes( current_pos() ) )
     current_pos( 0 );
 
-  for( int i = 0; i < sblocks(); ++i )
+  if( domain().includes( extent() ) )	// use the status counters
     {
-    const Sblock & sb = sblock( i );
-    if( !domain().includes( sb ) ) { if( domain() < sb ) break; else continue; }
-    if( filltypes.find( sb.status() ) >= filltypes.size() ) continue;
-    if( sb.end() <= current_pos() ) { ++filled_areas; filled_size += sb.size(); }
-    else if( sb.includes( current_pos() ) )
+    for( unsigned i = 0; i < filltypes.size(); ++i )
+      {
+      if( filltypes.find( filltypes[i] ) < i ) continue;	// repeated
+      const Sblock::Status st = Sblock::Status( filltypes[i] );
+      remaining_areas += status_count( st );
+      remaining_size += status_size( st );
+      }
+    // move to 'remaining' the areas not yet filled, if any
+    if( current_pos() > extent().pos() )
       {
-      filled_size += current_pos() - sb.pos();
-      ++remaining_areas; remaining_size += sb.end() - current_pos();
+      filled_areas = remaining_areas; filled_size = remaining_size;
+      remaining_areas = 0; remaining_size = 0;
+      const int start = std::max( find_index( current_pos() ), 0 );
+      for( int i = next_fill_index( start, filltypes ); i >= 0;
+           i = next_fill_index( i + 1, filltypes ) )
+        {
+        const Sblock & sb = sblock( i );
+        if( sb.end() <= current_pos() ) continue;
+        const long long size = sb.end() - std::max( sb.pos(), current_pos() );
+        --filled_areas; filled_size -= size;
+        ++remaining_areas; remaining_size += size;
+        }
+      }
+    }
+  else					// domain doesn't cover extent
+    {
+    int dcursor = 0;
+    for( int i = 0; i < sblocks(); ++i )
+      {
+      const Sblock & sb = sblock( i );
+      if( !domain().includes( sb, dcursor ) )
+        { if( domain() < sb ) break; else continue; }
+      if( filltypes.find( sb.status() ) >= filltypes.size() ) continue;
+      if( sb.end() <= current_pos() ) { ++filled_areas; filled_size += sb.size(); }
+      else if( sb.includes( current_pos() ) )
+        {
+        filled_size += current_pos() - sb.pos();
+        ++remaining_areas; remaining_size += sb.end() - current_pos();
+        }
+      else { ++remaining_areas; remaining_size += sb.size(); }
       }
-    else { ++remaining_areas; remaining_size += sb.size(); }
     }
   set_signals();
   if( verbosity >= 0 )
@@ -118,10 +118,11 @@ int Genbook::do_generate( const int odes )
   recsize = 0; gensize = 0;
   odes_ = odes;
 
+  int dcursor = 0;			// cursor for domain lookups
   for( int i = 0; i < sblocks(); ++i )
     {
     const Sblock & sb = sblock( i );
-    if( !domain().includes( sb ) )
+    if( !domain().includes( sb, dcursor ) )
       { if( domain() < sb ) break; else continue; }
     if( sb.status() == Sblock::finished ) recsize += sb.size();
     if( sb.status() != Sblock::non_tried ) gensize += sb.size();
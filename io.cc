@@ -32,7 +32,12 @@
 
 #include "block.h"
 #include "ddrescue.h"
+#include "io_backend.h"
 #include "loggers.h"
+#include "non_posix.h"
+#include "uring.h"
+#include "writer.h"
+#include "zero.h"
 
 
 namespace {
@@ -52,56 +57,41 @@ int set_signal( const int signum, void (*handler)( int ) )
   return sigaction( signum, &new_action, 0 );
   }
 
-
-bool block_is_zero( const uint8_t * const buf, const int size )
+long long now_ms()
   {
-  for( int i = 0; i < size; ++i ) if( buf[i] != 0 ) return false;
-  return true;
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
   }
 
+} // end namespace
+
 
-// Returns the number of bytes really read.
-// If (returned value < size) and (errno == 0), means EOF was reached.
+long long Group_commit::max_bytes_ = 0;
+long Group_commit::max_ms_ = 0;
+
+
+// Account 'size' bytes just written to 'fd', and sync it if due.
 //
-int readblock( const int fd, uint8_t * const buf, const int size,
-               const long long pos )
+bool Group_commit::written( const int fd, const long long size )
   {
-  int sz = 0;
-  errno = 0;
-  if( lseek( fd, pos, SEEK_SET ) >= 0 )
-    while( sz < size )
-      {
-      errno = 0;
-      const int n = read( fd, buf + sz, size - sz );
-      if( n > 0 ) sz += n;
-      else if( n == 0 ) break;				// EOF
-      else if( errno != EINTR ) break;
-      }
-  return sz;
+  pending_bytes += size;
+  if( max_bytes_ <= 0 && max_ms_ <= 0 ) return sync( fd );
+  const long long now = now_ms();
+  if( last_sync < 0 ) last_sync = now;
+  if( ( max_bytes_ > 0 && pending_bytes >= max_bytes_ ) ||
+      ( max_ms_ > 0 && now - last_sync >= max_ms_ ) ) return sync( fd );
+  return true;
   }
 
 
-// Returns the number of bytes really written.
-// If (returned value < size), it is always an error.
-//
-int writeblock( const int fd, const uint8_t * const buf, const int size,
-                const long long pos )
+bool Group_commit::sync( const int fd )
   {
-  int sz = 0;
-  errno = 0;
-  if( lseek( fd, pos, SEEK_SET ) >= 0 )
-    while( sz < size )
-      {
-      errno = 0;
-      const int n = write( fd, buf + sz, size - sz );
-      if( n > 0 ) sz += n;
-      else if( n < 0 && errno != EINTR ) break;
-      }
-  return sz;
+  pending_bytes = 0;
+  if( max_bytes_ > 0 || max_ms_ > 0 ) last_sync = now_ms();
+  return ( fsync( fd ) == 0 || errno == EINVAL );
   }
 
-} // end namespace
-
 
 // Return values: 1 write error, 0 OK.
 //
@@ -123,8 +113,8 @@ int Fillbook::fill_block( const Sblock & sb )
       if( len > 0 && len < bufsize )
         std::memset( buf + len, ' ', bufsize - len );
       }
-  if( writeblock( odes_, iobuf(), size, sb.pos() + offset() ) != size ||
-      ( synchronous_ && fsync( odes_ ) < 0 && errno != EINVAL ) )
+  if( io_backend->writeblock( odes_, iobuf(), size, sb.pos() + offset() ) !=
+      size || ( synchronous_ && !commit.written( odes_, size ) ) )
     {
     if( !ignore_write_errors ) final_msg( "Write error", errno );
     return 1;
@@ -136,7 +126,7 @@ int Fillbook::fill_block( const Sblock & sb )
 
 bool Fillbook::read_buffer( const int ides )
   {
-  const int rd = readblock( ides, iobuf(), softbs(), 0 );
+  const int rd = io_backend->readblock( ides, iobuf(), softbs(), 0 );
   if( rd <= 0 ) return false;
   for( int i = rd; i < softbs(); i *= 2 )
     {
@@ -152,7 +142,8 @@ bool Fillbook::read_buffer( const int ides )
 void Genbook::check_block( const Block & b, int & copied_size, int & error_size )
   {
   if( b.size() <= 0 ) internal_error( "bad size checking a Block." );
-  copied_size = readblock( odes_, iobuf(), b.size(), b.pos() + offset() );
+  copied_size = io_backend->readblock( odes_, iobuf(), b.size(),
+                                       b.pos() + offset() );
   if( errno ) error_size = b.size() - copied_size;
 
   for( int pos = 0; pos < copied_size; )
@@ -180,7 +171,8 @@ bool Rescuebook::extend_outfile_size()
     if( min_size > size )
       {
       const uint8_t zero = 0;
-      if( writeblock( odes_, &zero, 1, min_size - 1 ) != 1 ) return false;
+      if( io_backend->writeblock( odes_, &zero, 1, min_size - 1 ) != 1 )
+        return false;
       fsync( odes_ );
       }
     }
@@ -188,16 +180,140 @@ bool Rescuebook::extend_outfile_size()
   }
 
 
+// Returns the hole of the input file containing 'pos', or an empty block
+// if 'pos' is in data or the holes of the input file can't be found.
+// The last hole and data areas found are cached.
+//
+Block Rescuebook::input_hole( const long long pos )
+  {
+#ifdef SEEK_HOLE
+  if( seek_holes && !hole_cache.includes( pos ) && !data_cache.includes( pos ) )
+    {
+    const long long data = lseek( ides_, pos, SEEK_DATA );
+    if( data > pos ) hole_cache.assign( pos, data - pos );
+    else if( data == pos )
+      {
+      const long long hole = lseek( ides_, pos, SEEK_HOLE );
+      if( hole > pos ) data_cache.assign( pos, hole - pos );
+      else seek_holes = false;
+      }
+    else if( errno == ENXIO )		// no more data after pos
+      {
+      const long long end = lseek( ides_, 0, SEEK_END );
+      if( end > pos ) hole_cache.assign( pos, end - pos );
+      else data_cache.assign( pos, 1 );	// past EOF; read it
+      }
+    else seek_holes = false;		// not supported
+    }
+  if( seek_holes && hole_cache.includes( pos ) ) return hole_cache;
+#endif
+  return Block( pos, 0 );
+  }
+
+
+// If 'b' is contained in a hole of the input file, enlarge it up to the
+// end of the hole, or of the non-tried chunk containing 'b'.
+//
+void Rescuebook::extend_to_hole( Block & b )
+  {
+  const Block hole = input_hole( b.pos() );
+  if( hole.includes( b ) && hole.end() > b.end() )
+    {
+    b.size( std::min( hole.end() - b.pos(),
+                      (long long)( INT_MAX - INT_MAX % softbs() ) ) );
+    find_chunk( b, Sblock::non_tried, domain(), softbs() );
+    }
+  }
+
+
+// Return values: 1 write error, 0 OK.
+// Copy a block contained in a hole of the input file, without reading it.
+// The writes queued are finished first because the zeros are written by
+// this thread.
+//
+int Rescuebook::copy_hole( const Block & b, int & copied_size,
+                           int & error_size )
+  {
+  if( writer && sparse_size < 0 && reap_writes( true ) != 0 )
+    { copied_size = 0; error_size = 0; return 1; }
+  copied_size = b.size(); error_size = 0;
+  std::memset( iobuf(), 0, softbs() );
+  iobuf_ipos = b.pos();
+  const long long pos = b.pos() + offset();
+  if( sparse_size >= 0 )
+    { if( pos + copied_size > sparse_size ) sparse_size = pos + copied_size; }
+  else
+    {
+    for( int i = 0; i < copied_size; )
+      {
+      const int size = std::min( softbs(), copied_size - i );
+      if( io_backend->writeblock( odes_, iobuf(), size, pos + i ) != size )
+        { copied_size = 0; final_msg( "Write error", errno ); return 1; }
+      i += size;
+      }
+    if( synchronous_ && !commit.written( odes_, copied_size ) )
+      { copied_size = 0; final_msg( "Write error", errno ); return 1; }
+    }
+  read_logger.print_line( b.pos(), b.size(), copied_size, error_size );
+  return 0;
+  }
+
+
 // Return values: 1 write error, 0 OK.
 // If !OK, copied_size and error_size are set to 0.
 // If OK && copied_size + error_size < b.size(), it means EOF has been reached.
+// If write_queued is set, the data copied is still being written by the
+// writer thread and must not be marked as finished until popped.
 //
-int Rescuebook::copy_block( const Block & b, int & copied_size, int & error_size )
+int Rescuebook::copy_block( const Block & b, int & copied_size,
+                            int & error_size, bool & write_queued )
   {
-  if( b.size() <= 0 ) internal_error( "bad size copying a Block." );
+  write_queued = false;
+  if( b.size() > 0 && input_hole( b.pos() ).includes( b ) )
+    return copy_hole( b, copied_size, error_size );
+  if( b.size() <= 0 || b.size() > softbs() )
+    internal_error( "bad size copying a Block." );
+  const bool pipelined = ( writer && current_status() == copying );
+  if( writer && reap_writes( !pipelined ) != 0 )	// drain if not pipelined
+    { copied_size = 0; error_size = 0; return 1; }
+  uint8_t * buf = pipelined ? writer->buffer() : iobuf();
+  int res = 0;
+  uint8_t * const qbuf =
+    uring ? uring->pop( ides_, b.pos(), b.size(), res ) : 0;
+  if( !qbuf && zero_copy && sparse_size < 0 && preview_lines <= 0 &&
+      ( !test_domain || test_domain->includes( b ) ) )
+    {
+    const long long pos = b.pos() + offset();
+    const int n = copy_range( ides_, b.pos(), odes_, pos, b.size() );
+    if( n == b.size() )
+      {
+      if( synchronous_ && !commit.written( odes_, n ) )
+        {
+        copied_size = 0; error_size = 0;
+        final_msg( "Write error", errno );
+        return 1;
+        }
+      copied_size = n; error_size = 0; iobuf_ipos = -1;
+      read_logger.print_line( b.pos(), b.size(), copied_size, error_size );
+      return 0;
+      }		// else read the block again to find errors or EOF
+    if( n < 0 && errno != EIO && errno != EINTR && errno != EAGAIN )
+      zero_copy = false;		// not supported for these files
+    }
   if( !test_domain || test_domain->includes( b ) )
     {
-    copied_size = readblock( ides_, iobuf(), b.size(), b.pos() );
+    if( !qbuf || ( res < 0 && ( res == -EINTR || res == -EAGAIN ) ) )
+      copied_size = io_backend->readblock( ides_, buf, b.size(), b.pos() );
+    else if( res < 0 ) { copied_size = 0; errno = -res; }
+    else			// finish a short read synchronously
+      {
+      if( pipelined ) std::memcpy( buf, qbuf, res );	// qbuf will be reused
+      else buf = qbuf;
+      copied_size = res; errno = 0;
+      if( res < b.size() )
+        copied_size += io_backend->readblock( ides_, buf + res,
+                                              b.size() - res, b.pos() + res );
+      }
     error_size = errno ? b.size() - copied_size : 0;
     }
   else { copied_size = 0; error_size = b.size(); }
@@ -205,14 +321,19 @@ int Rescuebook::copy_block( const Block & b, int & copied_size, int & error_size
   if( copied_size > 0 )
     {
     iobuf_ipos = b.pos();
+    if( buf != iobuf() && preview_lines > 0 )	// copy data to be shown
+      std::memcpy( iobuf(), buf, std::min( copied_size, 16 * preview_lines ) );
     const long long pos = b.pos() + offset();
-    if( sparse_size >= 0 && block_is_zero( iobuf(), copied_size ) )
+    if( sparse_size >= 0 && block_is_zero( buf, copied_size ) )
       {
       const long long end = pos + copied_size;
       if( end > sparse_size ) sparse_size = end;
       }
-    else if( writeblock( odes_, iobuf(), copied_size, pos ) != copied_size ||
-             ( synchronous_ && fsync( odes_ ) < 0 && errno != EINVAL ) )
+    else if( pipelined )
+      { writer->push( b.pos(), copied_size ); write_queued = true; }
+    else if( io_backend->writeblock( odes_, buf, copied_size, pos ) !=
+             copied_size ||
+             ( synchronous_ && !commit.written( odes_, copied_size ) ) )
       {
       copied_size = 0; error_size = 0;
       final_msg( "Write error", errno );
@@ -0,0 +1,179 @@
+/*  GNU ddrescue - Data recovery tool
+    Copyright (C) 2015 Antonio Diaz Diaz.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _FILE_OFFSET_BITS 64
+
+#include <cerrno>
+#include <cstring>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "io_backend.h"
+
+
+namespace {
+
+// Writes the data in 'iov' not yet written, skipping the first 'done'
+// bytes, with one call to writeblock per buffer.
+// Returns the total number of bytes written, including 'done'.
+//
+int write_rest( const Io_backend & backend, const int fd,
+                const struct iovec * const iov, const int count,
+                const long long pos, int done )
+  {
+  int sz = 0;				// size of the buffers already seen
+  errno = 0;
+  for( int i = 0; i < count; sz += iov[i].iov_len, ++i )
+    {
+    const int len = iov[i].iov_len;
+    if( done >= sz + len ) continue;
+    const int skip = done - sz;
+    const int n = backend.writeblock( fd, (const uint8_t *)iov[i].iov_base + skip,
+                                      len - skip, pos + done );
+    done += n;
+    if( n < len - skip ) break;
+    }
+  return done;
+  }
+
+
+// Seeks to 'pos' and then reads or writes. Uses two system calls per
+// block, and the file offset is shared by all the threads.
+//
+class Lseek_backend : public Io_backend
+  {
+public:
+  const char * name() const { return "lseek"; }
+  bool thread_safe() const { return false; }
+
+  int readblock( const int fd, uint8_t * const buf, const int size,
+                 const long long pos ) const
+    {
+    int sz = 0;
+    errno = 0;
+    if( lseek( fd, pos, SEEK_SET ) >= 0 )
+      while( sz < size )
+        {
+        errno = 0;
+        const int n = read( fd, buf + sz, size - sz );
+        if( n > 0 ) sz += n;
+        else if( n == 0 ) break;			// EOF
+        else if( errno != EINTR ) break;
+        }
+    return sz;
+    }
+
+  int writeblock( const int fd, const uint8_t * const buf, const int size,
+                  const long long pos ) const
+    {
+    int sz = 0;
+    errno = 0;
+    if( lseek( fd, pos, SEEK_SET ) >= 0 )
+      while( sz < size )
+        {
+        errno = 0;
+        const int n = write( fd, buf + sz, size - sz );
+        if( n > 0 ) sz += n;
+        else if( n < 0 && errno != EINTR ) break;
+        }
+    return sz;
+    }
+  };
+
+
+// Positional reads and writes. One system call per block, and safe to
+// use from several threads on the same file descriptor.
+//
+class Pread_backend : public Io_backend
+  {
+public:
+  const char * name() const { return "pread"; }
+  bool thread_safe() const { return true; }
+
+  int readblock( const int fd, uint8_t * const buf, const int size,
+                 const long long pos ) const
+    {
+    int sz = 0;
+    errno = 0;
+    while( sz < size )
+      {
+      errno = 0;
+      const int n = pread( fd, buf + sz, size - sz, pos + sz );
+      if( n > 0 ) sz += n;
+      else if( n == 0 ) break;				// EOF
+      else if( errno != EINTR ) break;
+      }
+    return sz;
+    }
+
+  int writeblock( const int fd, const uint8_t * const buf, const int size,
+                  const long long pos ) const
+    {
+    int sz = 0;
+    errno = 0;
+    while( sz < size )
+      {
+      errno = 0;
+      const int n = pwrite( fd, buf + sz, size - sz, pos + sz );
+      if( n > 0 ) sz += n;
+      else if( n < 0 && errno != EINTR ) break;
+      }
+    return sz;
+    }
+
+#ifdef __linux__
+  int writeblocks( const int fd, const struct iovec * const iov,
+                   const int count, const long long pos ) const
+    {
+    int size = 0;
+    for( int i = 0; i < count; ++i ) size += iov[i].iov_len;
+    int n;
+    do { errno = 0; n = pwritev( fd, iov, count, pos ); }
+    while( n < 0 && errno == EINTR );
+    if( n < 0 ) return 0;
+    if( n >= size ) return n;
+    return write_rest( *this, fd, iov, count, pos, n );	// partial write
+    }
+#endif
+  };
+
+
+const Lseek_backend lseek_backend;
+const Pread_backend pread_backend;
+const Io_backend * const backends[] = { &lseek_backend, &pread_backend, 0 };
+
+} // end namespace
+
+
+const Io_backend * io_backend = &pread_backend;
+
+
+const Io_backend * Io_backend::find( const char * const name )
+  {
+  for( int i = 0; backends[i]; ++i )
+    if( std::strcmp( name, backends[i]->name() ) == 0 ) return backends[i];
+  return 0;
+  }
+
+
+const char * Io_backend::names() { return "lseek, pread"; }
+
+
+int Io_backend::writeblocks( const int fd, const struct iovec * const iov,
+                             const int count, const long long pos ) const
+  { return write_rest( *this, fd, iov, count, pos, 0 ); }
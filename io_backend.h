@@ -0,0 +1,50 @@
+/*  GNU ddrescue - Data recovery tool
+    Copyright (C) 2015 Antonio Diaz Diaz.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+struct iovec;
+
+// Interface used by Rescuebook, Fillbook and Genbook to read and write
+// blocks of data. The backend in use is selected at startup.
+//
+class Io_backend
+  {
+public:
+  virtual ~Io_backend() {}
+  virtual const char * name() const = 0;
+  // True if several threads may use the backend on the same file at once.
+  virtual bool thread_safe() const = 0;
+
+  // Returns the number of bytes really read.
+  // If (returned value < size) and (errno == 0), means EOF was reached.
+  virtual int readblock( const int fd, uint8_t * const buf, const int size,
+                         const long long pos ) const = 0;
+
+  // Returns the number of bytes really written.
+  // If (returned value < size), it is always an error.
+  virtual int writeblock( const int fd, const uint8_t * const buf,
+                          const int size, const long long pos ) const = 0;
+
+  // Writes the 'count' buffers in 'iov' one after another at 'pos'.
+  // Returns the number of bytes really written, like writeblock.
+  virtual int writeblocks( const int fd, const struct iovec * const iov,
+                           const int count, const long long pos ) const;
+
+  static const Io_backend * find( const char * const name );
+  static const char * names();		// list of valid names
+  };
+
+extern const Io_backend * io_backend;
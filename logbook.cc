@@ -28,8 +28,11 @@
 #include <stdint.h>
 #include <unistd.h>
 
+#include <pthread.h>
+
 #include "block.h"
 #include "ddrescue.h"
+#include "saver.h"
 
 
 namespace {
@@ -48,20 +51,23 @@ void input_pos_error( const long long pos, const long long isize )
 
 Logbook::Logbook( const long long offset, const long long isize, Domain & dom,
                   const char * const logname, const int cluster,
-                  const int hardbs, const bool complete_only )
+                  const int hardbs, const int min_alignment,
+                  const bool complete_only, const long long max_map_memory )
   : Logfile( logname ), offset_( offset ), logfile_isize_( 0 ),
     domain_( dom ), hardbs_( hardbs ), softbs_( cluster * hardbs ),
-    final_msg_( 0 ), final_errno_( 0 ),
-    ul_t1( 0 ), logfile_exists_( false )
+    alignment_( sysconf( _SC_PAGESIZE ) ), final_msg_( 0 ), final_errno_( 0 ),
+    ul_t1( 0 ), saver_( 0 ), logfile_exists_( false )
   {
-  int alignment = sysconf( _SC_PAGESIZE );
-  if( alignment < hardbs_ || alignment % hardbs_ ) alignment = hardbs_;
-  if( alignment < 2 || alignment > 65536 ) alignment = 0;
-  iobuf_ = iobuf_base = new uint8_t[ softbs_ + alignment ];
-  if( alignment > 1 )		// align iobuf for use with raw devices
+  if( alignment_ > 0 && min_alignment > alignment_ &&	// device I/O unit
+      min_alignment <= 65536 && min_alignment % alignment_ == 0 )
+    alignment_ = min_alignment;
+  if( alignment_ < hardbs_ || alignment_ % hardbs_ ) alignment_ = hardbs_;
+  if( alignment_ < 2 || alignment_ > 65536 ) alignment_ = 0;
+  iobuf_ = iobuf_base = new uint8_t[ softbs_ + alignment_ ];
+  if( alignment_ > 1 )		// align iobuf for use with raw devices
     {
-    const int disp = alignment - ( reinterpret_cast<long> (iobuf_) % alignment );
-    if( disp > 0 && disp < alignment ) iobuf_ += disp;
+    const int disp = alignment_ - ( reinterpret_cast<long> (iobuf_) % alignment_ );
+    if( disp > 0 && disp < alignment_ ) iobuf_ += disp;
     }
 
   if( isize > 0 )
@@ -70,6 +76,7 @@ Logbook::Logbook( const long long offset, const long long isize, Domain & dom,
       { input_pos_error( domain_.pos(), isize ); std::exit( 1 ); }
     domain_.crop_by_file_size( isize );
     }
+  if( max_map_memory > 0 ) limit_map_memory( max_map_memory );
   if( filename() )
     {
     logfile_exists_ = read_logfile();
@@ -83,23 +90,45 @@ Logbook::Logbook( const long long offset, const long long isize, Domain & dom,
   }
 
 
-// Writes periodically the logfile to disc.
-// Returns false only if update is attempted and fails.
+// Returns true if it is time to update the logfile, and restarts the
+// interval. The interval grows with the number of sblocks.
 //
-bool Logbook::update_logfile( const int odes, const bool force )
+bool Logbook::logfile_due( const bool force )
   {
-  if( !filename() ) return true;
-  const int interval = 30 + std::min( 270, sblocks() / 38 );	// 30s to 5m
+  const int interval = journaling() ? 1 :
+                       30 + std::min( 270, sblocks() / 38 );	// 30s to 5m
   const long t2 = std::time( 0 );
   if( ul_t1 == 0 ) ul_t1 = t2;				// initialize
-  if( !force && t2 - ul_t1 < interval ) return true;
+  if( !force && t2 - ul_t1 < interval ) return false;
   ul_t1 = t2;
+  return true;
+  }
+
+
+// Writes periodically the logfile to disc.
+// In journal mode, appends the changes to the journal every second, and
+// only writes the whole logfile when the journal grows too large.
+// If a saver is set, passes a snapshot of the logfile to it instead, and
+// only writes the logfile here when forced or if the last save failed.
+// Returns false only if update is attempted and fails.
+//
+bool Logbook::update_logfile( const int odes, const bool force )
+  {
+  if( !filename() || !logfile_due( force ) ) return true;
+  if( saver_ && !journaling() )
+    {
+    if( !force && saver_->save( *this, odes ) ) return true;
+    saver_->wait();			// don't let it overwrite our write
+    }
   if( odes >= 0 ) fsync( odes );
+  const bool append = ( journaling() && !force && !journal_full() );
 
   while( true )
     {
     errno = 0;
-    if( write_logfile( 0, true ) ) return true;
+    if( append ) { if( append_journal() ) return true; }
+    else if( ( !journaling() || append_journal() ) &&	// journal complete
+             write_logfile( 0, true ) ) return true;
     if( verbosity < 0 ) return false;
     const int saved_errno = errno;
     std::fprintf( stderr, "\n" );
@@ -19,49 +19,214 @@
 
 #include <algorithm>
 #include <cctype>
+#include <cerrno>
+#include <climits>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <string>
 #include <vector>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "block.h"
 
 
 namespace {
 
-int my_fgetc( FILE * const f )
+// Binary logfile format (all numbers are little endian):
+//   header: magic[6] version[1] current_status[1] current_pos[8]
+//           records[8] records_crc[4] header_crc[4]
+//   record: pos[8] size[8] status[1] zero[7]
+//
+const uint8_t binary_magic[6] = { 'D', 'D', 'R', 'M', 'A', 'P' };
+enum { binary_version = 1, header_size = 32, record_size = 24 };
+
+
+class CRC32			// slicing-by-4
+  {
+  uint32_t data[4][256];	// Table of CRCs of all 8-bit messages.
+
+public:
+  CRC32()
+    {
+    for( unsigned n = 0; n < 256; ++n )
+      {
+      unsigned c = n;
+      for( int k = 0; k < 8; ++k )
+        { if( c & 1 ) c = 0xEDB88320U ^ ( c >> 1 ); else c >>= 1; }
+      data[0][n] = c;
+      }
+    for( unsigned n = 0; n < 256; ++n )
+      for( int k = 1; k < 4; ++k )
+        data[k][n] = data[0][data[k-1][n]&0xFF] ^ ( data[k-1][n] >> 8 );
+    }
+
+  uint32_t update( uint32_t crc, const uint8_t * const buffer,
+                   const long long size ) const
+    {
+    crc = ~crc;
+    long long i = 0;
+    for( ; i + 4 <= size; i += 4 )
+      {
+      crc ^= buffer[i] | ( buffer[i+1] << 8 ) | ( buffer[i+2] << 16 ) |
+             ( (uint32_t)buffer[i+3] << 24 );
+      crc = data[3][crc&0xFF] ^ data[2][(crc>>8)&0xFF] ^
+            data[1][(crc>>16)&0xFF] ^ data[0][crc>>24];
+      }
+    for( ; i < size; ++i )
+      crc = data[0][(crc^buffer[i])&0xFF] ^ ( crc >> 8 );
+    return ~crc;
+    }
+  };
+
+const CRC32 crc32;
+
+
+void put_le( uint8_t * const p, unsigned long long value, const int size )
+  { for( int i = 0; i < size; ++i ) { p[i] = value & 0xFF; value >>= 8; } }
+
+unsigned long long get_le( const uint8_t * const p, const int size )
+  {
+  unsigned long long value = 0;
+  for( int i = size - 1; i >= 0; --i ) value = ( value << 8 ) + p[i];
+  return value;
+  }
+
+
+void put_record( uint8_t * const p, const Sblock & sb )
   {
-  int ch = std::fgetc( f );
-  if( ch == '#' )			// comment
-    { do ch = std::fgetc( f ); while( ch != '\n' && ch != EOF ); }
-  return ch;
+  put_le( p, sb.pos(), 8 );
+  put_le( p + 8, sb.size(), 8 );
+  put_le( p + 16, sb.status(), 8 );
   }
 
 
+inline bool isspace_c( const int ch )		// isspace in the C locale
+  { return ( ch == ' ' || ( ch >= '\t' && ch <= '\r' ) ); }
+
+
+// Reads the lines of a logfile through a large buffer, without locking
+// the stream for every character.
+//
+class Line_reader
+  {
+  enum { buffer_size = 65536, maxlen = 127 };
+  FILE * const f;
+  int pos, size;			// next and end of data in buffer
+  char line[maxlen+1];
+  char buffer[buffer_size];
+
+public:
+  int linenum;
+
+  explicit Line_reader( FILE * const file )
+    : f( file ), pos( 0 ), size( 0 ), linenum( 0 ) {}
+
+  const char * get_line();
+  };
+
+
 // Read a line discarding comments, leading whitespace and blank lines.
 // Returns 0 if at EOF.
 //
-const char * my_fgets( FILE * const f, int & linenum )
+const char * Line_reader::get_line()
   {
-  const int maxlen = 127;
-  static char buf[maxlen+1];
-  int ch, len = 1;
-
-  while( len == 1 )			// while line is blank
+  int len = 0;
+  bool comment = false;
+  while( true )
     {
-    do { ch = my_fgetc( f ); if( ch == '\n' ) ++linenum; }
-    while( std::isspace( ch ) );
-    len = 0;
-    while( true )
+    if( pos >= size )
+      {
+      pos = 0; size = std::fread( buffer, 1, buffer_size, f );
+      if( size <= 0 )					// EOF
+        {
+        size = 0;
+        if( len <= 0 ) return 0;
+        ++linenum;
+        if( len < maxlen ) line[len++] = '\n';
+        line[len] = 0; return line;
+        }
+      }
+    const char * p = buffer + pos;			// scan the buffer
+    const char * const end = buffer + size;
+    while( p < end )
       {
-      if( ch == EOF ) { if( len > 0 ) ch = '\n'; else break; }
-      if( len < maxlen ) buf[len++] = ch;
-      if( ch == '\n' ) { ++linenum; break; }
-      ch = my_fgetc( f );
+      const char ch = *p++;
+      if( ch == '\n' )
+        {
+        ++linenum; comment = false;
+        if( len <= 0 ) continue;			// blank line
+        if( len < maxlen ) line[len++] = ch;
+        line[len] = 0; pos = p - buffer; return line;
+        }
+      if( comment ) continue;
+      if( ch == '#' ) { comment = true; continue; }
+      if( len <= 0 && isspace_c( ch ) ) continue;
+      if( len < maxlen ) line[len++] = ch;
       }
+    pos = size;
     }
-  if( len > 0 ) { buf[len] = 0; return buf; }
-  else return 0;
+  }
+
+
+// Parse an integer in the format read by the "%lli" conversion of scanf,
+// skipping leading whitespace. Returns false if there are no digits.
+//
+bool parse_llong( const char * & p, long long & value )
+  {
+  while( isspace_c( *p ) ) ++p;
+  const char * q = p;
+  bool negative = false;
+  if( *q == '+' || *q == '-' ) negative = ( *q++ == '-' );
+  int base = 10;
+  if( *q == '0' )
+    {
+    base = 8;
+    if( ( q[1] == 'x' || q[1] == 'X' ) && std::isxdigit( (unsigned char)q[2] ) )
+      { base = 16; q += 2; }
+    }
+  const char * const digits = q;
+  const unsigned long long limit = ULLONG_MAX / base;
+  unsigned long long v = 0;
+  bool overflow = false;
+  while( true )
+    {
+    const int ch = (unsigned char)*q;
+    int d;
+    if( ch >= '0' && ch <= '9' ) d = ch - '0';
+    else if( ch >= 'a' && ch <= 'f' ) d = ch - 'a' + 10;
+    else if( ch >= 'A' && ch <= 'F' ) d = ch - 'A' + 10;
+    else break;
+    if( d >= base ) break;
+    if( v > limit || v * base > ULLONG_MAX - d ) overflow = true;
+    else v = ( v * base ) + d;
+    ++q;
+    }
+  if( q == digits ) return false;
+  p = q;
+  if( overflow || v > LLONG_MAX )
+    value = negative ? LLONG_MIN : LLONG_MAX;	// saturate like strtoll
+  else value = negative ? -(long long)v : (long long)v;
+  return true;
+  }
+
+
+// Parse a line in the format "%lli %lli %c", or "%lli %c" if 'size' is
+// null. Returns the number of fields assigned, like sscanf.
+//
+int parse_line( const char * p, long long & pos, long long * const size,
+                char & ch )
+  {
+  if( !parse_llong( p, pos ) ) return 0;
+  int n = 1;
+  if( size ) { if( !parse_llong( p, *size ) ) return n; ++n; }
+  while( isspace_c( *p ) ) ++p;
+  if( !*p ) return n;
+  ch = *p;
+  return n + 1;
   }
 
 
@@ -72,27 +237,51 @@ void show_logfile_error( const char * const logname, const int linenum )
   show_error( buf );
   }
 
-} // end namespace
+
+// Writes the part of the header of a text logfile following the comments.
+bool write_status_lines( FILE * const f, const long long current_pos,
+                         const int current_status )
+  {
+  return ( std::fprintf( f, "# current_pos  current_status\n"
+                            "0x%08llX     %c\n"
+                            "#      pos        size  status\n",
+                         current_pos, current_status ) >= 0 );
+  }
 
 
-void Logfile::compact_sblock_vector()
+bool write_binary_header( FILE * const f, const long long current_pos,
+                          const int current_status,
+                          const unsigned long long records,
+                          const uint32_t records_crc )
   {
-  std::vector< Sblock > new_vector;
-  unsigned l = 0;
-  while( l < sblock_vector.size() )
-    {
-    Sblock run = sblock_vector[l];
-    unsigned r = l + 1;
-    while( r < sblock_vector.size() &&
-           sblock_vector[r].status() == run.status() ) ++r;
-    if( r > l + 1 ) run.size( sblock_vector[r-1].end() - run.pos() );
-    new_vector.push_back( run );
-    l = r;
-    }
-  sblock_vector.swap( new_vector );
+  uint8_t header[header_size];
+  std::memcpy( header, binary_magic, sizeof binary_magic );
+  header[6] = binary_version;
+  header[7] = current_status;
+  put_le( header + 8, current_pos, 8 );
+  put_le( header + 16, records, 8 );
+  put_le( header + 24, records_crc, 4 );
+  put_le( header + 28, crc32.update( 0, header, header_size - 4 ), 4 );
+  return ( std::fwrite( header, 1, header_size, f ) == header_size );
   }
 
 
+// 'record' < 0 means an error in the header or in the checksum.
+void show_binary_error( const char * const logname, const long long record )
+  {
+  char buf[80];
+  if( record < 0 )
+    snprintf( buf, sizeof buf, "error in binary logfile %s, bad header or checksum.",
+              logname );
+  else
+    snprintf( buf, sizeof buf, "error in binary logfile %s, record %lld.",
+              logname, record );
+  show_error( buf );
+  }
+
+} // end namespace
+
+
 void Logfile::extend_sblock_vector( const long long isize )
   {
   if( sblock_vector.empty() )
@@ -101,10 +290,10 @@ void Logfile::extend_sblock_vector( const long long isize )
     sblock_vector.push_back( sb );
     return;
     }
-  Sblock & front = sblock_vector.front();
-  if( front.pos() > 0 )
-    sblock_vector.insert( sblock_vector.begin(), Sblock( 0, front.pos(), Sblock::non_tried ) );
-  Sblock & back = sblock_vector.back();
+  const long long front_pos = sblock_vector.pos( 0 );
+  if( front_pos > 0 )
+    sblock_vector.insert( 0, Sblock( 0, front_pos, Sblock::non_tried ) );
+  const Sblock back = sblock_vector.back();
   const long long end = back.end();
   if( isize > 0 )
     {
@@ -120,7 +309,7 @@ void Logfile::extend_sblock_vector( const long long isize )
     if( end > isize )
       {
       if( back.status() != Sblock::finished )
-        { back.size( isize - back.pos() ); return; }
+        { sblock_vector.move_end( isize ); return; }
       show_error( "Rescued data in logfile goes past end of input file.\n"
                   "          Use '-C' if you are reading from a partial copy.",
                   0, true );
@@ -142,6 +331,7 @@ void Logfile::extend_sblock_vector( const long long isize )
 //
 bool Logfile::truncate_vector( const long long end, const bool force )
   {
+  rewrite_needed_ = true;
   unsigned i = sblock_vector.size();
   while( i > 0 && sblock_vector[i-1].pos() >= end ) --i;
   if( !force )
@@ -154,13 +344,11 @@ bool Logfile::truncate_vector( const long long end, const bool force )
     }
   else
     {
-    Sblock & sb = sblock_vector[i-1];
-    if( sb.includes( end ) )
-      {
-      if( !force && sb.status() == Sblock::finished ) return false;
-      sb.size( end - sb.pos() );
-      }
-    sblock_vector.erase( sblock_vector.begin() + i, sblock_vector.end() );
+    const Sblock sb = sblock_vector[i-1];
+    if( sb.includes( end ) && !force && sb.status() == Sblock::finished )
+      return false;
+    sblock_vector.truncate( i );
+    if( sb.includes( end ) ) sblock_vector.move_end( end );
     }
   return true;
   }
@@ -173,16 +361,18 @@ bool Logfile::read_logfile( const int default_sblock_status )
   {
   FILE * const f = std::fopen( filename_, "r" );
   if( !f ) return false;
-  int linenum = 0;
+  Line_reader reader( f );
+  const int & linenum = reader.linenum;
   const bool loose = Sblock::isstatus( default_sblock_status );
   read_only_ = false;
   sblock_vector.clear();
 
-  const char * line = my_fgets( f, linenum );
+  binary_ = read_binary_logfile( f, default_sblock_status );
+  const char * line = binary_ ? 0 : reader.get_line();
   if( line )						// status line
     {
     char ch;
-    int n = std::sscanf( line, "%lli %c\n", &current_pos_, &ch );
+    int n = parse_line( line, current_pos_, 0, ch );
     if( n == 2 && current_pos_ >= 0 && isstatus( ch ) )
       current_status_ = Status( ch );
     else
@@ -194,12 +384,13 @@ bool Logfile::read_logfile( const int default_sblock_status )
 
     while( true )
       {
-      line = my_fgets( f, linenum );
+      line = reader.get_line();
       if( !line ) break;
       long long pos, size;
-      n = std::sscanf( line, "%lli %lli %c\n", &pos, &size, &ch );
+      n = parse_line( line, pos, &size, ch );
       if( n == 3 && pos >= 0 && Sblock::isstatus( ch ) &&
-          ( size > 0 || ( size == 0 && pos == 0 ) ) )
+          ( size > 0 || ( size == 0 && pos == 0 ) ) &&
+          pos <= LLONG_MAX - size )
         {
         const Sblock::Status st = Sblock::Status( ch );
         const Sblock sb( pos, size, st );
@@ -222,30 +413,245 @@ bool Logfile::read_logfile( const int default_sblock_status )
     }
   if( std::ferror( f ) )
     { show_logfile_error( filename_, linenum ); std::exit( 2 ); }
+  replay_journal();
   if( std::freopen( filename_, "r+", f ) ) std::fclose( f );
   else read_only_ = true;
   return true;
   }
 
 
+// A binary logfile is written as text to a terminal.
+//
 int Logfile::write_logfile( FILE * f, const bool timestamp ) const
   {
   const bool f_given = ( f != 0 );
 
   if( !f && !filename_ ) return false;
+  if( !f && ( journaling_ || journal_exists_ ) )	// keep journal valid
+    return replace_logfile( timestamp );
   if( !f ) { f = std::fopen( filename_, "w" ); if( !f ) return false; }
-  write_logfile_header( f, "Rescue" );
-  if( timestamp ) write_timestamp( f );
-  if( current_msg.size() ) std::fprintf( f, "# %s\n", current_msg.c_str() );
-  std::fprintf( f, "# current_pos  current_status\n" );
-  std::fprintf( f, "0x%08llX     %c\n", current_pos_, current_status_ );
-  std::fprintf( f, "#      pos        size  status\n" );
+  bool error = false;
+  if( binary_ && !isatty( fileno( f ) ) ) error = !write_binary_logfile( f );
+  else
+    {
+    write_logfile_header( f, "Rescue" );
+    if( timestamp ) write_timestamp( f );
+    if( current_msg.size() ) std::fprintf( f, "# %s\n", current_msg.c_str() );
+    write_status_lines( f, current_pos_, current_status_ );
+    for( unsigned i = 0; i < sblock_vector.size(); ++i )
+      {
+      const Sblock & sb = sblock_vector[i];
+      std::fprintf( f, "0x%08llX  0x%08llX  %c\n", sb.pos(), sb.size(), sb.status() );
+      }
+    }
+  if( f_given ) return !error;
+  if( std::fclose( f ) != 0 || error ) return false;
+  journal_buf.clear(); journal_size_ = 0; rewrite_needed_ = false;
+  return true;
+  }
+
+
+// Writes the logfile to a temporary file, syncs it, and renames it to
+// the name of the logfile, so that the logfile is never left half
+// written. The journal, if any, is removed only after the rename, when
+// its changes are included in the logfile. (A crash before the removal
+// leaves a journal whose replay does not change the new logfile).
+//
+bool Logfile::replace_logfile( const bool timestamp ) const
+  {
+  if( !filename_ ) return false;
+  const std::string tmpname = std::string( filename_ ) + ".tmp";
+  FILE * const f = std::fopen( tmpname.c_str(), "w" );
+  if( !f ) return false;
+  struct stat st;
+  if( stat( filename_, &st ) == 0 ) fchmod( fileno( f ), st.st_mode & 07777 );
+  bool error = ( !write_logfile( f, timestamp ) || std::fflush( f ) != 0 ||
+                 fdatasync( fileno( f ) ) != 0 );
+  if( std::fclose( f ) != 0 ) error = true;
+  if( !error && std::rename( tmpname.c_str(), filename_ ) == 0 )
+    {
+    if( journal_exists_ )	// the journal is now included in logfile
+      { std::remove( journal_name().c_str() ); journal_exists_ = false; }
+    journal_buf.clear(); journal_size_ = 0; rewrite_needed_ = false;
+    return true;
+    }
+  const int saved_errno = errno;
+  std::remove( tmpname.c_str() );
+  errno = saved_errno;
+  return false;
+  }
+
+
+// If 'f' starts with the magic of a binary logfile, reads the logfile
+// from it, mapped in memory if possible, and returns true.
+// Else rewinds 'f' and returns false.
+//
+bool Logfile::read_binary_logfile( FILE * const f,
+                                   const int default_sblock_status )
+  {
+  uint8_t header[header_size];
+  if( std::fread( header, 1, header_size, f ) != header_size ||
+      std::memcmp( header, binary_magic, sizeof binary_magic ) != 0 )
+    { std::rewind( f ); return false; }
+  const bool loose = Sblock::isstatus( default_sblock_status );
+  const unsigned long long records = get_le( header + 16, 8 );
+  struct stat st;
+  current_pos_ = get_le( header + 8, 8 );
+  if( header[6] != binary_version || !isstatus( header[7] ) ||
+      current_pos_ < 0 || get_le( header + 28, 4 ) !=
+      crc32.update( 0, header, header_size - 4 ) ||
+      fstat( fileno( f ), &st ) != 0 || records > LLONG_MAX / record_size ||
+      st.st_size != header_size + (long long)records * record_size )
+    { show_binary_error( filename_, -1 ); std::exit( 2 ); }
+  current_status_ = Status( header[7] );
+
+  const uint8_t * data;
+  std::vector< uint8_t > buffer;
+  void * const map = mmap( 0, st.st_size, PROT_READ, MAP_PRIVATE, fileno( f ), 0 );
+  if( map != MAP_FAILED ) data = (const uint8_t *)map + header_size;
+  else
+    {
+    buffer.resize( st.st_size - header_size + 1 );
+    if( (long long)std::fread( &buffer[0], 1, buffer.size(), f ) !=
+        st.st_size - header_size )
+      { show_binary_error( filename_, -1 ); std::exit( 2 ); }
+    data = &buffer[0];
+    }
+  if( get_le( header + 24, 4 ) !=
+      crc32.update( 0, data, st.st_size - header_size ) )
+    { show_binary_error( filename_, -1 ); std::exit( 2 ); }
+
+  for( unsigned long long i = 0; i < records; ++i )
+    {
+    const uint8_t * const p = data + i * record_size;
+    const long long pos = get_le( p, 8 );
+    const long long size = get_le( p + 8, 8 );
+    const int ch = p[16];
+    if( pos < 0 || !Sblock::isstatus( ch ) ||
+        ( size <= 0 && ( size != 0 || pos != 0 ) ) || pos > LLONG_MAX - size )
+      { show_binary_error( filename_, i ); std::exit( 2 ); }
+    const long long end = sblock_vector.size() ?
+                          sblock_vector.back().end() : 0;
+    if( pos != end )
+      {
+      if( loose && pos > end )
+        sblock_vector.push_back( Sblock( end, pos - end,
+                                 Sblock::Status( default_sblock_status ) ) );
+      else if( end > 0 )
+        { show_binary_error( filename_, i ); std::exit( 2 ); }
+      }
+    sblock_vector.push_back( Sblock( pos, size, Sblock::Status( ch ) ) );
+    }
+  if( map != MAP_FAILED ) munmap( map, st.st_size );
+  return true;
+  }
+
+
+// Writes the logfile in binary format. The records are encoded twice;
+// first to compute their checksum, then to write them after the header.
+//
+bool Logfile::write_binary_logfile( FILE * const f ) const
+  {
+  const int records_per_buffer = 4096;
+  uint8_t buffer[records_per_buffer*record_size];
+  uint32_t crc = 0;
   for( unsigned i = 0; i < sblock_vector.size(); ++i )
     {
-    const Sblock & sb = sblock_vector[i];
-    std::fprintf( f, "0x%08llX  0x%08llX  %c\n", sb.pos(), sb.size(), sb.status() );
+    put_record( buffer, sblock_vector[i] );
+    crc = crc32.update( crc, buffer, record_size );
+    }
+  if( !write_binary_header( f, current_pos_, current_status_,
+                            sblock_vector.size(), crc ) ) return false;
+
+  for( unsigned i = 0; i < sblock_vector.size(); )
+    {
+    int n = 0;
+    for( ; n < records_per_buffer && i < sblock_vector.size(); ++n, ++i )
+      put_record( buffer + n * record_size, sblock_vector[i] );
+    if( (int)std::fwrite( buffer, record_size, n, f ) != n ) return false;
+    }
+  return true;
+  }
+
+
+// Append to the journal the changes made since the last append, followed
+// by the current position and status. The journal is created (or
+// truncated) by the first append after writing the logfile, and synced
+// after each append, as the output file has been synced before it.
+// Returns false if the append fails.
+//
+bool Logfile::append_journal() const
+  {
+  if( journal_buf.empty() ) return true;
+  FILE * const f = std::fopen( journal_name().c_str(), journal_size_ ? "a" : "w" );
+  if( !f ) return false;
+  journal_exists_ = true;
+  bool error = ( journal_size_ == 0 &&
+                 !write_logfile_header( f, "Journal" ) );
+  if( !error )
+    error = ( std::fputs( journal_buf.c_str(), f ) == EOF ||
+              std::fprintf( f, "0x%08llX     %c\n", current_pos_,
+                            current_status_ ) < 0 );
+  const long long size = std::ftell( f );
+  if( !error && ( std::fflush( f ) != 0 || fdatasync( fileno( f ) ) != 0 ) )
+    error = true;
+  if( std::fclose( f ) != 0 || error || size < 0 ) return false;
+  journal_size_ = size;
+  journal_buf.clear();
+  return true;
+  }
+
+
+// Apply the changes recorded in the journal of the logfile, if any.
+// An incomplete last record (from an interrupted append) is ignored.
+// Returns false if there is no journal.
+//
+bool Logfile::replay_journal()
+  {
+  const std::string name = journal_name();
+  FILE * const f = std::fopen( name.c_str(), "r" );
+  if( !f ) return false;
+  journal_exists_ = true;
+  Line_reader reader( f );
+  bool changed = false;
+  const char * line;
+  while( ( line = reader.get_line() ) != 0 )
+    {
+    long long pos, size;
+    char ch;
+    if( parse_line( line, pos, &size, ch ) == 3 &&
+        pos >= 0 && size > 0 && Sblock::isstatus( ch ) )
+      { set_status( Block( pos, size ), Sblock::Status( ch ) );
+        changed = true; }
+    else if( parse_line( line, pos, 0, ch ) == 2 &&
+             pos >= 0 && isstatus( ch ) )
+      { current_pos_ = pos; current_status_ = Status( ch ); }
+    else
+      {
+      const int errline = reader.linenum;
+      if( reader.get_line() )			// not the last line
+        { show_logfile_error( name.c_str(), errline ); std::exit( 2 ); }
+      }
+    }
+  std::fclose( f );
+  if( changed ) compact_sblock_vector();
+  return true;
+  }
+
+
+// Set the status of all the data in 'b' to 'st', splitting the sblocks
+// at the borders of 'b'. The part of 'b' beyond the vector is ignored.
+//
+void Logfile::set_status( const Block & b, const Sblock::Status st )
+  {
+  int i = find_index( b.pos() );
+  if( i < 0 ) return;
+  if( try_split_sblock_by( b.pos(), i ) ) ++i;
+  for( ; i < sblocks() && sblock_vector[i].pos() < b.end(); ++i )
+    {
+    try_split_sblock_by( b.end(), i );
+    sblock_vector.status( i, st );
     }
-  return ( f_given || std::fclose( f ) == 0 );
   }
 
 
@@ -258,72 +664,90 @@ bool Logfile::blank() const
   }
 
 
+// Splits in place the sblocks including a border of the domain. Each
+// border is found by binary search, so the time is proportional to the
+// number of domain blocks, not to the size of the logfile.
+//
 void Logfile::split_by_domain_borders( const Domain & domain )
   {
-  if( domain.blocks() == 1 )
+  for( int j = 0; j < domain.blocks(); ++j )
     {
-    const Block & db = domain.block( 0 );
-    unsigned i = 0;
-    while( i < sblock_vector.size() && sblock_vector[i] < db ) ++i;
-    if( i < sblock_vector.size() ) try_split_sblock_by( db.pos(), i );
-    i = sblock_vector.size();
-    while( i > 0 && db < sblock_vector[i-1] ) --i;
-    if( i > 0 ) try_split_sblock_by( db.end(), i - 1 );
-    }
-  else
-    {
-    std::vector< Sblock > new_vector;
-    int j = 0;
-    for( unsigned i = 0; i < sblock_vector.size(); )
-      {
-      Sblock & sb = sblock_vector[i];
-      while( j < domain.blocks() && domain.block( j ) < sb ) ++j;
-      if( j >= domain.blocks() )		// end of domain tail copy
-        { new_vector.insert( new_vector.end(),
-                             sblock_vector.begin() + i, sblock_vector.end() );
-          break; }
-      const Block & db = domain.block( j );
-      if( sb.strictly_includes( db.pos() ) )
-        new_vector.push_back( sb.split( db.pos() ) );
-      if( sb.strictly_includes( db.end() ) )
-        new_vector.push_back( sb.split( db.end() ) );
-      if( sb.pos() < db.end() ) { new_vector.push_back( sb ); ++i; }
-      }
-    sblock_vector.swap( new_vector );
+    const Block & db = domain.block( j );
+    sblock_vector.split_at( db.pos() );
+    sblock_vector.split_at( db.end() );
     }
   }
 
 
-void Logfile::split_by_logfile_borders( const Logfile & logfile )
+// Replaces the sblocks with a map from 0 to the end of the domain, in
+// which the blocks of size 'hardbs' whose numbers are listed in 'blocks'
+// and that are included in the domain have status 'type1', and the rest
+// of the map has status 'type2'. 'blocks' is sorted in place. The map is
+// built by appending sblocks in one pass, instead of changing the status
+// of one block at a time. The sblocks are split at the domain borders.
+//
+void Logfile::make_from_list( std::vector< long long > & blocks,
+                              const int hardbs, const Domain & domain,
+                              const Sblock::Status type1,
+                              const Sblock::Status type2 )
   {
-  std::vector< Sblock > new_vector;
-  int j = 0;
-  for( unsigned i = 0; i < sblock_vector.size(); )
+  std::sort( blocks.begin(), blocks.end() );
+  sblock_vector.clear();
+  rewrite_needed_ = true;
+  long long pos = 0;
+  unsigned i = 0;
+  for( int j = 0; j < domain.blocks(); ++j )
     {
-    Sblock & sb = sblock_vector[i];
-    while( j < logfile.sblocks() && logfile.sblock( j ) < sb ) ++j;
-    if( j >= logfile.sblocks() )		// end of logfile tail copy
-      { new_vector.insert( new_vector.end(),
-                           sblock_vector.begin() + i, sblock_vector.end() );
-        break; }
-    const Sblock & db = logfile.sblock( j );
-    if( sb.strictly_includes( db.pos() ) )
-      new_vector.push_back( sb.split( db.pos() ) );
-    if( sb.strictly_includes( db.end() ) )
-      new_vector.push_back( sb.split( db.end() ) );
-    if( sb.pos() < db.end() ) { new_vector.push_back( sb ); ++i; }
+    const Block & db = domain.block( j );
+    if( pos < db.pos() )
+      sblock_vector.push_back( Sblock( pos, db.pos() - pos, type2 ) );
+    Sblock sb( db.pos(), 0, type2 );	// last sblock of db, not yet added
+    for( ; i < blocks.size(); ++i )
+      {
+      const Block b( blocks[i] * hardbs, hardbs );
+      if( b.pos() >= db.end() ) break;
+      if( b.pos() < sb.end() || !db.includes( b ) ) continue;
+      if( b.pos() > sb.end() )			// blocks not listed
+        {
+        if( sb.status() != type2 )
+          { sblock_vector.push_back( sb ); sb = Sblock( sb.end(), 0, type2 ); }
+        sb.size( b.pos() - sb.pos() );
+        }
+      if( sb.status() != type1 )
+        {
+        if( sb.size() > 0 ) sblock_vector.push_back( sb );
+        sb = Sblock( b.pos(), 0, type1 );
+        }
+      sb.size( b.end() - sb.pos() );
+      }
+    if( sb.end() < db.end() )			// rest of db
+      {
+      if( sb.status() != type2 )
+        { sblock_vector.push_back( sb ); sb = Sblock( sb.end(), 0, type2 ); }
+      sb.size( db.end() - sb.pos() );
+      }
+    sblock_vector.push_back( sb );
+    pos = db.end();
     }
-  sblock_vector.swap( new_vector );
   }
 
 
+// Walks from the last index found if 'pos' is near it. Else (for example
+// when several threads read far apart) searches the sblock map.
+//
 int Logfile::find_index( const long long pos ) const
   {
   if( index_ < 0 || index_ >= sblocks() ) index_ = sblocks() / 2;
-  while( index_ + 1 < sblocks() && pos >= sblock_vector[index_+1].pos() )
-    ++index_;
-  while( index_ > 0 && pos < sblock_vector[index_].pos() )
-    --index_;
+  const int near = 8;
+  int i = index_;
+  while( i + 1 < sblocks() && pos >= sblock_vector.pos( i + 1 ) &&
+         i - index_ < near ) ++i;
+  while( i > 0 && pos < sblock_vector.pos( i ) && index_ - i < near ) --i;
+  if( !sblock_vector[i].includes( pos ) &&
+      ( ( i + 1 < sblocks() && pos >= sblock_vector.pos( i + 1 ) ) ||
+        ( i > 0 && pos < sblock_vector.pos( i ) ) ) )
+    i = std::max( sblock_vector.find( pos ), 0 );
+  index_ = i;
   if( !sblock_vector[index_].includes( pos ) ) index_ = -1;
   return index_;
   }
@@ -339,11 +763,14 @@ void Logfile::find_chunk( Block & b, const Sblock::Status st,
   if( b.pos() < sblock_vector.front().pos() )
     b.pos( sblock_vector.front().pos() );
   if( find_index( b.pos() ) < 0 ) { b.size( 0 ); return; }
-  int i;
-  for( i = index_; i < sblocks(); ++i )
-    if( sblock_vector[i].status() == st && domain.includes( sblock_vector[i] ) )
-      { index_ = i; break; }
-  if( i >= sblocks() ) { b.size( 0 ); return; }
+  int i = index_, dcursor = 0;
+  while( ( i = sblock_vector.find_status( i, st ) ) >= 0 )
+    {
+    if( domain.includes( sblock_vector[i], dcursor ) ) { index_ = i; break; }
+    if( sblock_vector[i].pos() >= domain.end() ) { i = -1; break; }
+    ++i;
+    }
+  if( i < 0 ) { b.size( 0 ); return; }
   if( b.pos() < sblock_vector[index_].pos() )
     b.pos( sblock_vector[index_].pos() );
   if( !sblock_vector[index_].includes( b ) )
@@ -363,10 +790,13 @@ void Logfile::rfind_chunk( Block & b, const Sblock::Status st,
   if( sblock_vector.back().end() < b.end() )
     b.end( sblock_vector.back().end() );
   if( find_index( b.end() - 1 ) < 0 ) { b.size( 0 ); return; }
-  int i;
-  for( i = index_; i >= 0; --i )
-    if( sblock_vector[i].status() == st && domain.includes( sblock_vector[i] ) )
-      { index_ = i; break; }
+  int i = index_, dcursor = 0;
+  while( ( i = sblock_vector.rfind_status( i, st ) ) >= 0 )
+    {
+    if( domain.includes( sblock_vector[i], dcursor ) ) { index_ = i; break; }
+    if( sblock_vector[i].end() <= domain.pos() ) { i = -1; break; }
+    --i;
+    }
   if( i < 0 ) { b.size( 0 ); return; }
   if( b.end() > sblock_vector[index_].end() )
     b.end( sblock_vector[index_].end() );
@@ -399,6 +829,13 @@ int Logfile::change_chunk_status( const Block & b, const Sblock::Status st,
     internal_error( "can't change status of chunk spread over more than 1 block." );
   const Sblock::Status old_st = sblock_vector[index_].status();
   if( st == old_st ) return 0;
+  if( journaling_ )
+    {
+    char buf[48];
+    snprintf( buf, sizeof buf, "0x%08llX  0x%08llX  %c\n",
+              b.pos(), b.size(), st );
+    journal_buf += buf;
+    }
   const bool old_st_good = Sblock::is_good_status( old_st );
   const bool new_st_good = Sblock::is_good_status( st );
   bool bl_st_good = ( index_ <= 0 ||
@@ -414,10 +851,10 @@ int Logfile::change_chunk_status( const Block & b, const Sblock::Status st,
         index_ + 1 < sblocks() && sblock_vector[index_+1].status() == st &&
         domain.includes( sblock_vector[index_+1] ) )
       {
-      sblock_vector[index_].shift( sblock_vector[index_+1], b.pos() );
+      sblock_vector.move_pos( index_ + 1, b.pos() );
       return 0;
       }
-    insert_sblock( index_, sblock_vector[index_].split( b.pos() ) );
+    sblock_vector.split( index_, b.pos() );
     ++index_;
     bl_st_good = old_st_good;
     }
@@ -425,15 +862,15 @@ int Logfile::change_chunk_status( const Block & b, const Sblock::Status st,
     {
     if( index_ > 0 && sblock_vector[index_-1].status() == st &&
         domain.includes( sblock_vector[index_-1] ) )
-      sblock_vector[index_-1].shift( sblock_vector[index_], b.end() );
+      sblock_vector.move_pos( index_, b.end() );
     else
-      insert_sblock( index_,
-                     Sblock( sblock_vector[index_].split( b.end() ), st ) );
+      { sblock_vector.split( index_, b.end() );
+        sblock_vector.status( index_, st ); }
     br_st_good = old_st_good;
     }
   else
     {
-    sblock_vector[index_].status( st );
+    sblock_vector.status( index_, st );
     const bool bl_join = ( index_ > 0 &&
                            sblock_vector[index_-1].status() == st &&
                            domain.includes( sblock_vector[index_-1] ) );
@@ -442,11 +879,8 @@ int Logfile::change_chunk_status( const Block & b, const Sblock::Status st,
                            domain.includes( sblock_vector[index_+1] ) );
     if( bl_join || br_join )
       {
-      if( br_join ) sblock_vector[index_].join( sblock_vector[index_+1] );
-      if( bl_join )
-        { --index_; sblock_vector[index_].join( sblock_vector[index_+1] ); }
-      sblock_vector.erase( sblock_vector.begin() + ( index_ + 1 ),
-                           sblock_vector.begin() + ( index_ + 1 + bl_join + br_join ) );
+      if( bl_join ) --index_;		// erase joins them to index_
+      sblock_vector.erase( index_ + 1, index_ + 1 + bl_join + br_join );
       }
     }
   int retval = 0;
@@ -470,3 +904,302 @@ const char * Logfile::status_name( const Logfile::Status st )
     }
   return "unknown";			// should not be reached
   }
+
+
+struct Logfile_reader::Source
+  {
+  enum { records_per_buffer = 4096 };
+  const char * const filename;
+  FILE * const f;
+  Line_reader reader;
+  const int default_sblock_status;
+  bool binary;
+  unsigned long long records, record;	// records in binary file and read
+  int buffered, index;			// records in buffer and next one
+  uint32_t crc, records_crc;
+  long long end;			// end of last sblock read
+  bool gap;				// sblock held after a gap
+  long long held_pos, held_size;
+  Sblock::Status held_status;
+  uint8_t buffer[records_per_buffer*record_size];
+
+  Source( const char * const name, FILE * const file,
+          const int default_st )
+    : filename( name ), f( file ), reader( file ),
+      default_sblock_status( default_st ), binary( false ), records( 0 ),
+      record( 0 ), buffered( 0 ), index( 0 ), crc( 0 ), records_crc( 0 ),
+      end( 0 ), gap( false ), held_pos( 0 ), held_size( 0 ),
+      held_status( Sblock::non_tried ) {}
+  ~Source() { std::fclose( f ); }
+
+  void read_header( long long & current_pos, Logfile::Status & current_status );
+  bool read_record( long long & pos, long long & size, Sblock::Status & st );
+  bool get( long long & pos, long long & size, Sblock::Status & st );
+  void show_record_error() const
+    { if( binary ) show_binary_error( filename, record - 1 );
+      else show_logfile_error( filename, reader.linenum ); }
+  };
+
+
+// Reads the header of a binary logfile, or the status line of a text
+// logfile, with the same checks as 'read_logfile'.
+//
+void Logfile_reader::Source::read_header( long long & current_pos,
+                                          Logfile::Status & current_status )
+  {
+  uint8_t header[header_size];
+  if( std::fread( header, 1, header_size, f ) == header_size &&
+      std::memcmp( header, binary_magic, sizeof binary_magic ) == 0 )
+    {
+    binary = true;
+    records = get_le( header + 16, 8 );
+    records_crc = get_le( header + 24, 4 );
+    current_pos = get_le( header + 8, 8 );
+    struct stat st;
+    if( header[6] != binary_version || !Logfile::isstatus( header[7] ) ||
+        current_pos < 0 || get_le( header + 28, 4 ) !=
+        crc32.update( 0, header, header_size - 4 ) ||
+        fstat( fileno( f ), &st ) != 0 || records > LLONG_MAX / record_size ||
+        st.st_size != header_size + (long long)records * record_size )
+      { show_binary_error( filename, -1 ); std::exit( 2 ); }
+    current_status = Logfile::Status( header[7] );
+    return;
+    }
+  std::rewind( f );
+  const char * const line = reader.get_line();
+  if( !line ) return;
+  char ch;
+  const int n = parse_line( line, current_pos, 0, ch );
+  if( n == 2 && current_pos >= 0 && Logfile::isstatus( ch ) )
+    current_status = Logfile::Status( ch );
+  else
+    {
+    show_logfile_error( filename, reader.linenum );
+    show_error( "Are you using a logfile from ddrescue 1.5 or older?" );
+    std::exit( 2 );
+    }
+  }
+
+
+// Reads the next record of the logfile. Returns false at EOF.
+//
+bool Logfile_reader::Source::read_record( long long & pos, long long & size,
+                                          Sblock::Status & st )
+  {
+  int ch;
+  if( binary )
+    {
+    if( index >= buffered )
+      {
+      if( record >= records )
+        {
+        if( crc != records_crc )
+          { show_binary_error( filename, -1 ); std::exit( 2 ); }
+        return false;
+        }
+      buffered = std::min( records - record,
+                           (unsigned long long)records_per_buffer );
+      if( (int)std::fread( buffer, record_size, buffered, f ) != buffered )
+        { show_binary_error( filename, -1 ); std::exit( 2 ); }
+      crc = crc32.update( crc, buffer, buffered * record_size );
+      index = 0;
+      }
+    const uint8_t * const p = buffer + index++ * record_size;
+    ++record;
+    pos = get_le( p, 8 );
+    size = get_le( p + 8, 8 );
+    ch = p[16];
+    }
+  else
+    {
+    const char * const line = reader.get_line();
+    if( !line )
+      {
+      if( std::ferror( f ) ) { show_record_error(); std::exit( 2 ); }
+      return false;
+      }
+    char c;
+    if( parse_line( line, pos, &size, c ) != 3 )
+      { show_record_error(); std::exit( 2 ); }
+    ch = c;
+    }
+  if( pos < 0 || !Sblock::isstatus( ch ) ||
+      ( size <= 0 && ( size != 0 || pos != 0 ) ) || pos > LLONG_MAX - size )
+    { show_record_error(); std::exit( 2 ); }
+  st = Sblock::Status( ch );
+  return true;
+  }
+
+
+// Returns the next sblock, after filling the gap before it if the
+// logfile is read in loose mode.
+//
+bool Logfile_reader::Source::get( long long & pos, long long & size,
+                                  Sblock::Status & st )
+  {
+  if( gap ) { pos = held_pos; size = held_size; st = held_status; gap = false; }
+  else
+    {
+    if( !read_record( pos, size, st ) ) return false;
+    if( pos != end )
+      {
+      if( Sblock::isstatus( default_sblock_status ) && pos > end )
+        {
+        held_pos = pos; held_size = size; held_status = st; gap = true;
+        size = pos - end; pos = end;
+        st = Sblock::Status( default_sblock_status );
+        }
+      else if( end > 0 ) { show_record_error(); std::exit( 2 ); }
+      }
+    }
+  end = pos + size;
+  return true;
+  }
+
+
+Logfile_reader::Logfile_reader( const char * const logname,
+                                const int default_st )
+  : source( 0 ), logfile( logname ), default_sblock_status( default_st ),
+    index( 0 ), current_pos_( 0 ), current_status_( Logfile::copying ),
+    binary_( false ), pending( false ), next_pos( 0 ),
+    next_status( Sblock::non_tried ), first_pos( 0 ), end( 0 ), sblocks_( 0 )
+  {}
+
+
+Logfile_reader::~Logfile_reader() { delete source; }
+
+
+// Returns true if logfile exists and is readable.
+//
+bool Logfile_reader::open()
+  {
+  FILE * const jf = std::fopen( logfile.journal_name().c_str(), "r" );
+  if( jf )
+    {
+    std::fclose( jf );
+    if( !logfile.read_logfile( default_sblock_status ) ) return false;
+    logfile.compact_sblock_vector();
+    current_pos_ = logfile.current_pos();
+    current_status_ = logfile.current_status();
+    binary_ = logfile.binary();
+    first_pos = end = logfile.extent().pos();
+    return true;
+    }
+  FILE * const f = std::fopen( filename(), "r" );
+  if( !f ) return false;
+  source = new Source( filename(), f, default_sblock_status );
+  source->read_header( current_pos_, current_status_ );
+  binary_ = source->binary;
+  long long size;
+  pending = source->get( next_pos, size, next_status );
+  first_pos = end = next_pos;
+  return true;
+  }
+
+
+// Returns in 'sb' the next sblock of the logfile. Consecutive sblocks of
+// the same status are joined. Returns false at the end of the logfile.
+//
+bool Logfile_reader::next( Sblock & sb )
+  {
+  if( !source )
+    {
+    if( index >= logfile.sblocks() ) return false;
+    sb = logfile.sblock( index++ );
+    }
+  else
+    {
+    if( !pending ) return false;
+    long long pos, size;
+    Sblock::Status st;
+    while( true )
+      {
+      if( !source->get( pos, size, st ) )
+        {
+        sb = Sblock( next_pos, source->end - next_pos, next_status );
+        pending = false; break;
+        }
+      if( st != next_status )
+        {
+        sb = Sblock( next_pos, pos - next_pos, next_status );
+        next_pos = pos; next_status = st; break;
+        }
+      }
+    }
+  end = sb.end(); ++sblocks_;
+  return true;
+  }
+
+
+Logfile_writer::Logfile_writer()
+  : spool( std::tmpfile() ), last( 0, 0, Sblock::non_tried ), records( 0 ),
+    crc( 0 ), pending( false )
+  {
+  if( !spool )
+    { show_error( "Can't create temporary file", errno ); std::exit( 1 ); }
+  }
+
+
+Logfile_writer::~Logfile_writer() { std::fclose( spool ); }
+
+
+void Logfile_writer::spool_last()
+  {
+  uint8_t record[record_size];
+  put_record( record, last );
+  crc = crc32.update( crc, record, record_size );
+  if( std::fwrite( record, 1, record_size, spool ) != record_size )
+    { show_error( "Error writing temporary file", errno ); std::exit( 1 ); }
+  ++records;
+  }
+
+
+// 'sb' must begin where the last sblock added ends.
+//
+void Logfile_writer::add( const Sblock & sb )
+  {
+  if( pending && sb.status() == last.status() )
+    { last.size( sb.end() - last.pos() ); return; }
+  if( pending ) spool_last();
+  last = sb; pending = true;
+  }
+
+
+// Writes to 'f' the logfile formed by the sblocks added, in binary format
+// if 'binary' is true and 'f' is not a terminal.
+// Returns false if a write error happens.
+//
+bool Logfile_writer::write( FILE * const f, const long long current_pos,
+                            const Logfile::Status current_status,
+                            const bool binary )
+  {
+  const bool bin = ( binary && !isatty( fileno( f ) ) );
+  if( pending ) { spool_last(); pending = false; }
+  std::rewind( spool );
+  if( bin )
+    { if( !write_binary_header( f, current_pos, current_status, records, crc ) )
+        return false; }
+  else if( !write_logfile_header( f, "Rescue" ) ||
+           !write_status_lines( f, current_pos, current_status ) )
+    return false;
+
+  const int records_per_buffer = 4096;
+  uint8_t buffer[records_per_buffer*record_size];
+  for( long long i = 0; i < records; )
+    {
+    const int n = std::min( records - i, (long long)records_per_buffer );
+    if( (int)std::fread( buffer, record_size, n, spool ) != n )
+      { show_error( "Error reading temporary file", errno ); std::exit( 1 ); }
+    i += n;
+    if( bin )
+      { if( (int)std::fwrite( buffer, record_size, n, f ) != n ) return false;
+        continue; }
+    for( int j = 0; j < n; ++j )
+      {
+      const uint8_t * const p = buffer + j * record_size;
+      if( std::fprintf( f, "0x%08llX  0x%08llX  %c\n", get_le( p, 8 ),
+                        get_le( p + 8, 8 ), p[16] ) < 0 ) return false;
+      }
+    }
+  return true;
+  }
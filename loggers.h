@@ -26,6 +26,7 @@ public:
   Logger() : f( 0 ), error( false ) {}
 
   void set_filename( const char * const name ) { filename_ = name; }
+  bool active() const { return f != 0; }
   bool close_file();
   };
 
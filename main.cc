@@ -39,11 +39,13 @@
 #include <sys/stat.h>
 
 #include "arg_parser.h"
+#include "io_backend.h"
 #include "rational.h"
 #include "block.h"
 #include "ddrescue.h"
 #include "loggers.h"
 #include "non_posix.h"
+#include "uring.h"
 
 #ifndef O_BINARY
 #define O_BINARY 0
@@ -80,7 +82,7 @@ void show_help( const int cluster, const int hardbs, const int skipbs )
                "  -A, --try-again                mark non-trimmed, non-scraped as non-tried\n"
                "  -b, --sector-size=<bytes>      sector size of input device [default %d]\n", hardbs );
   std::printf( "  -B, --binary-prefixes          show binary multipliers in numbers [SI]\n"
-               "  -c, --cluster-size=<sectors>   sectors to copy at a time [%d]\n", cluster );
+               "  -c, --cluster-size=<n>[,<max>] sectors to copy at a time [%d]\n", cluster );
   std::printf( "  -C, --complete-only            do not read new data beyond logfile limits\n"
                "  -d, --direct                   use direct disc access for input file\n"
                "  -D, --odirect                  use direct disc access for output file\n"
@@ -119,11 +121,22 @@ void show_help( const int cluster, const int hardbs, const int skipbs )
                "  -1, --log-rates=<file>         log rates and error sizes in file\n"
                "  -2, --log-reads=<file>         log all read operations in file\n"
                "      --ask                      ask for confirmation before starting the copy\n"
+               "      --async-logfile            save logfile from a separate thread\n"
                "      --cpass=<n>[,<n>]          select what copying pass(es) to run\n"
+               "      --group-commit=<b>[,<ms>]  sync output every <b> bytes or <ms> ms [1000]\n"
+               "      --io-engine=<name>         I/O functions to use (lseek, pread) [pread]\n"
+               "      --io-uring[=<n>]           queue <n> reads at a time using io_uring [8]\n"
+               "      --journal                  append logfile changes to a journal file\n"
+               "      --max-map-memory=<bytes>   keep at most <bytes> of logfile map in memory\n"
                "      --max-read-rate=<bytes>    maximum read rate in bytes/s\n"
                "      --pause=<interval>         time to wait between passes [0]\n"
+               "      --pipeline[=<n>]           write copied data from a separate thread [4]\n"
+               "      --threads=<n>              read first pass with <n> threads in stripes\n"
+               "      --zero-copy                copy good data inside the kernel\n"
                "Numbers may be in decimal, hexadecimal or octal, and may be followed by a\n"
                "multiplier: s = sectors, k = 1000, Ki = 1024, M = 10^6, Mi = 2^20, etc...\n"
+               "If known, the logical sector size of infile is the default sector size;\n"
+               "its physical sector size is only used to align buffers and clusters.\n"
                "Time intervals have the format 1[.5][smhd] or 1/2[smhd].\n"
                "\nExit status: 0 for a normal exit, 1 for environmental problems (file\n"
                "not found, invalid flags, I/O errors, etc), 2 to indicate a corrupt or\n"
@@ -386,13 +399,26 @@ bool user_agrees_ids( const Rescuebook & rescuebook, const char * const iname,
   }
 
 
+// Size of the physical I/O unit of the device (physical sector or minimum
+// I/O size), or 0 if unknown.
+//
+int topology_unit( const Device_topology & dt )
+  {
+  const int unit = std::max( dt.physical_size, dt.io_min );
+  if( dt.logical_size > 0 && unit > 0 && unit % dt.logical_size == 0 )
+    return unit;
+  return 0;
+  }
+
+
 int do_rescue( const long long offset, Domain & domain,
                const Domain * const test_domain, const Rb_options & rb_opts,
                const char * const iname, const char * const oname,
                const char * const logname, const int cluster,
                const int hardbs, const int o_trunc,
                const bool ask, const bool preallocate,
-               const bool synchronous, const bool verify_input_size )
+               const bool synchronous, const bool verify_input_size,
+               const Device_topology * const topology )
   {
   const int ides = open( iname, O_RDONLY | rb_opts.o_direct_in | O_BINARY );
   if( ides < 0 )
@@ -405,7 +431,9 @@ int do_rescue( const long long offset, Domain & domain,
       if( isize <= 0 || isize > size ) isize = size; }
 
   Rescuebook rescuebook( offset, isize, domain, test_domain, rb_opts, iname,
-                         logname, cluster, hardbs, synchronous );
+                         logname, cluster, hardbs,
+                         topology ? topology_unit( *topology ) : 0,
+                         synchronous );
 
   if( verify_input_size )
     {
@@ -466,13 +494,27 @@ int do_rescue( const long long offset, Domain & domain,
     std::printf( "    Starting positions: infile = %sB,  outfile = %sB\n",
                  format_num( rescuebook.domain().pos() ),
                  format_num( rescuebook.domain().pos() + rescuebook.offset() ) );
-    std::printf( "    Copy block size: %3d sectors", cluster );
+    if( rescuebook.min_copybs > 0 )
+      std::printf( "    Copy block size: %3d to %d sectors",
+                   rescuebook.min_copybs / hardbs, cluster );
+    else
+      std::printf( "    Copy block size: %3d sectors", cluster );
     if( rescuebook.skipbs > 0 )
       std::printf( "       Initial skip size: %d sectors\n",
                    rescuebook.skipbs / hardbs );
     else
       std::printf( "       Skipping disabled\n" );
     std::printf( "Sector size: %sBytes\n", format_num( hardbs, 99999 ) );
+    if( topology )
+      {
+      std::printf( "Device sectors: logical %sB, physical %sB",
+                   format_num( topology->logical_size, 99999 ),
+                   format_num( topology->physical_size, 99999 ) );
+      std::printf( "    I/O size: min %sB, opt %sB,",
+                   format_num( topology->io_min, 99999 ),
+                   format_num( topology->io_opt, 99999 ) );
+      std::printf( " max %sB\n", format_num( topology->max_io, 99999 ) );
+      }
     if( verbosity >= 2 )
       {
       bool nl = false;
@@ -505,6 +547,7 @@ int do_rescue( const long long offset, Domain & domain,
                                   format_time( rescuebook.timeout ) ); }
       if( nl ) { nl = false; std::fputc( '\n', stdout ); }
 
+      std::printf( "I/O engine: %s\n", io_backend->name() );
       std::printf( "Direct in: %s    ", rescuebook.o_direct_in ? "yes" : "no " );
       std::printf( "Direct out: %s    ", rescuebook.o_direct_out ? "yes" : "no " );
       std::printf( "Sparse: %s    ", rescuebook.sparse ? "yes" : "no " );
@@ -517,7 +560,25 @@ int do_rescue( const long long offset, Domain & domain,
       std::fputc( '\n', stdout );
       if( rescuebook.complete_only )
         { nl = true; std::printf( "Complete only    " ); }
-      if( rescuebook.reverse ) { nl = true; std::printf( "Reverse mode" ); }
+      if( rescuebook.reverse ) { nl = true; std::printf( "Reverse mode    " ); }
+      if( rescuebook.uring_depth > 0 )
+        { nl = true; std::printf( "Io_uring reads: %d    ", rescuebook.uring_depth ); }
+      if( rescuebook.write_buffers > 0 )
+        { nl = true; std::printf( "Write buffers: %d    ", rescuebook.write_buffers ); }
+      if( Group_commit::max_bytes() > 0 )
+        { nl = true;
+          std::printf( "Group commit: %sB or %ld ms    ",
+                       format_num( Group_commit::max_bytes() ),
+                       Group_commit::max_ms() ); }
+      if( rescuebook.threads > 1 )
+        { nl = true; std::printf( "Threads: %d    ", rescuebook.threads ); }
+      if( rescuebook.journaling() ) { nl = true; std::printf( "Journal    " ); }
+      if( rescuebook.async_logfile )
+        { nl = true; std::printf( "Async logfile    " ); }
+      if( rescuebook.max_map_memory > 0 )
+        { nl = true; std::printf( "Max map memory: %sB    ",
+                                  format_num( rescuebook.max_map_memory ) ); }
+      if( rescuebook.zero_copy ) { nl = true; std::printf( "Zero copy" ); }
       if( nl ) { nl = false; std::fputc( '\n', stdout ); }
       }
     std::fputc( '\n', stdout );
@@ -555,6 +616,24 @@ void parse_cpass( const std::string & arg, Rb_options & rb_opts )
     }
   }
 
+void parse_cluster( const char * const arg, int & cluster, int & min_cluster )
+  {
+  const char * const arg2 = std::strchr( arg, ',' );
+
+  cluster = getnum( arg, 0, 1, INT_MAX, arg2 != 0 );
+  min_cluster = 0;
+  if( arg2 )
+    {
+    min_cluster = cluster;
+    cluster = getnum( arg2 + 1, 0, 1, INT_MAX );
+    if( min_cluster > cluster )
+      {
+      show_error( "'min cluster size' is larger than 'max cluster size'." );
+      std::exit( 1 );
+      }
+    }
+  }
+
 void parse_skipbs( const char * const arg, Rb_options & rb_opts,
                    const int hardbs )
   {
@@ -577,17 +656,75 @@ void parse_skipbs( const char * const arg, Rb_options & rb_opts,
     }
   }
 
+// Derive default sector and cluster sizes from the topology of the input
+// device. Sizes given in the command line are not changed.
+// The sector size is the logical one, so that the areas trimmed, scraped
+// and retried, and marked as bad, are as small as the device allows. The
+// physical unit is only used to round up the cluster size.
+//
+void topology_defaults( const Device_topology & dt, const bool hardbs_given,
+                        int & hardbs, int & cluster, const int cluster_bytes,
+                        const int max_hardbs )
+  {
+  if( !hardbs_given && dt.logical_size > 0 && dt.logical_size <= max_hardbs )
+    hardbs = dt.logical_size;
+  if( cluster <= 0 )
+    {
+    long long bytes = std::max( cluster_bytes, dt.io_opt );
+    const int unit = topology_unit( dt );
+    if( unit > 0 && bytes % unit ) bytes += unit - ( bytes % unit );
+    if( dt.max_io >= hardbs && bytes > dt.max_io ) bytes = dt.max_io;
+    cluster = std::max( 1LL, bytes / hardbs );
+    }
+  }
+
+void parse_group_commit( const char * const arg, const int hardbs )
+  {
+  const char * const arg2 = std::strchr( arg, ',' );
+  const long long max_bytes = getnum( arg, hardbs, 1, LLONG_MAX, true );
+  const long max_ms = arg2 ? getnum( arg2 + 1, 0, 1, INT_MAX ) : 1000;
+  Group_commit::set_limits( max_bytes, max_ms );
+  }
+
 void check_o_direct()
   {
   if( O_DIRECT == 0 )
     { show_error( "Direct disc access not available." ); std::exit( 1 ); }
   }
 
+void set_io_engine( const char * const name )
+  {
+  const Io_backend * const backend = Io_backend::find( name );
+  if( !backend )
+    {
+    std::string msg( "Unknown I/O engine '" ); msg += name;
+    msg += "'. Valid engines are: "; msg += Io_backend::names(); msg += '.';
+    show_error( msg.c_str(), 0, true );
+    std::exit( 1 );
+    }
+  io_backend = backend;
+  }
+
+void check_zero_copy()
+  {
+  if( !copy_range_available() )
+    { show_error( "Zero-copy (copy_file_range) not available." );
+      std::exit( 1 ); }
+  }
+
+void check_io_uring()
+  {
+  if( !Uring_reader::available() )
+    { show_error( "Asynchronous reads (io_uring) not available." );
+      std::exit( 1 ); }
+  }
+
 } // end namespace
 
 
 bool Rescuebook::reopen_infile()
   {
+  if( uring ) uring->clear();		// discard pending reads
   if( ides_ >= 0 ) close( ides_ );
   ides_ = open( iname_, O_RDONLY | o_direct_in | O_BINARY );
   if( ides_ < 0 )
@@ -601,7 +738,9 @@ bool Rescuebook::reopen_infile()
 
 int main( const int argc, const char * const argv[] )
   {
-  enum Optcode { opt_ask = 256, opt_cpa, opt_pau, opt_rat };
+  enum Optcode { opt_ask = 256, opt_asy, opt_cpa, opt_eng, opt_gro, opt_jou,
+                 opt_mmm, opt_pau, opt_pip, opt_rat, opt_thr, opt_uri,
+                 opt_zer };
   long long ipos = 0;
   long long opos = -1;
   long long max_size = -1;
@@ -611,7 +750,9 @@ int main( const int argc, const char * const argv[] )
   const int default_hardbs = 512;
   const int max_hardbs = Rb_options::max_max_skipbs;
   int cluster = 0;
+  int min_cluster = 0;			// adaptive cluster size if > 0
   int hardbs = default_hardbs;
+  bool hardbs_given = false;
   int o_trunc = 0;
   Mode program_mode = m_none;
   Fb_options fb_opts;
@@ -623,6 +764,7 @@ int main( const int argc, const char * const argv[] )
   bool synchronous = false;
   bool verify_input_size = false;
   std::string filltypes;
+  std::vector< int > sector_args;	// options parsed once hardbs is known
   invocation_name = argv[0];
   command_line = argv[0];
   for( int i = 1; i < argc; ++i )
@@ -674,9 +816,18 @@ int main( const int argc, const char * const argv[] )
     { 'X', "exit-on-error",       Arg_parser::no  },
     { 'y', "synchronous",         Arg_parser::no  },
     { opt_ask, "ask",             Arg_parser::no  },
+    { opt_asy, "async-logfile",   Arg_parser::no  },
     { opt_cpa, "cpass",           Arg_parser::yes },
+    { opt_eng, "io-engine",       Arg_parser::yes },
+    { opt_gro, "group-commit",    Arg_parser::yes },
+    { opt_uri, "io-uring",        Arg_parser::maybe },
+    { opt_jou, "journal",         Arg_parser::no  },
+    { opt_mmm, "max-map-memory",  Arg_parser::yes },
     { opt_pau, "pause",           Arg_parser::yes },
+    { opt_pip, "pipeline",        Arg_parser::maybe },
+    { opt_thr, "threads",         Arg_parser::yes },
     { opt_rat, "max-read-rate",   Arg_parser::yes },
+    { opt_zer, "zero-copy",       Arg_parser::no  },
     {  0 , 0,                     Arg_parser::no  } };
 
   const Arg_parser parser( argc, argv, options );
@@ -693,17 +844,18 @@ int main( const int argc, const char * const argv[] )
       {
       case '1': rate_logger.set_filename( arg ); break;
       case '2': read_logger.set_filename( arg ); break;
-      case 'a': rb_opts.min_read_rate = getnum( arg, hardbs, 0 ); break;
+      case 'a': sector_args.push_back( argind ); break;
       case 'A': rb_opts.try_again = true; break;
-      case 'b': hardbs = getnum( arg, 0, 1, max_hardbs ); break;
+      case 'b': hardbs = getnum( arg, 0, 1, max_hardbs );
+                hardbs_given = true; break;
       case 'B': format_num( 0, 0, -1 ); break;		// set binary prefixes
-      case 'c': cluster = getnum( arg, 0, 1, INT_MAX ); break;
+      case 'c': parse_cluster( arg, cluster, min_cluster ); break;
       case 'C': rb_opts.complete_only = true; break;
       case 'd': rb_opts.o_direct_in = O_DIRECT; check_o_direct(); break;
       case 'D': rb_opts.o_direct_out = O_DIRECT; check_o_direct(); break;
       case 'e': rb_opts.new_errors_only = ( *arg == '+' );
                 rb_opts.max_errors = getnum( arg, 0, 0, INT_MAX ); break;
-      case 'E': rb_opts.max_error_rate = getnum( arg, hardbs, 0 ); break;
+      case 'E': sector_args.push_back( argind ); break;
       case 'f': force = true; break;
       case 'F': set_mode( program_mode, m_fill ); filltypes = arg;
                 fb_opts.write_location_data =
@@ -713,15 +865,15 @@ int main( const int argc, const char * const argv[] )
                            Rb_options::default_skipbs );
                 return 0;
       case 'H': set_name( &test_mode_logfile_name, arg, code ); break;
-      case 'i': ipos = getnum( arg, hardbs, 0 ); break;
+      case 'i': sector_args.push_back( argind ); break;
       case 'I': verify_input_size = true; break;
-      case 'K': parse_skipbs( arg, rb_opts, hardbs ); break;
+      case 'K': sector_args.push_back( argind ); break;
       case 'L': loose = true; break;
       case 'm': set_name( &domain_logfile_name, arg, code ); break;
       case 'M': rb_opts.retrim = true; break;
       case 'n': rb_opts.noscrape = true; break;
       case 'N': rb_opts.notrim = true; break;
-      case 'o': opos = getnum( arg, hardbs, 0 ); break;
+      case 'o': sector_args.push_back( argind ); break;
       case 'O': rb_opts.reopen_on_error = true; break;
       case 'p': preallocate = true; break;
       case 'P': rb_opts.preview_lines = arg[0] ? getnum( arg, 0, 1, 32 ) : 3;
@@ -729,7 +881,7 @@ int main( const int argc, const char * const argv[] )
       case 'q': verbosity = -1; break;
       case 'r': rb_opts.max_retries = getnum( arg, 0, -1, INT_MAX ); break;
       case 'R': rb_opts.reverse = true; break;
-      case 's': max_size = getnum( arg, hardbs, -1 ); break;
+      case 's': sector_args.push_back( argind ); break;
       case 'S': rb_opts.sparse = true; break;
       case 't': o_trunc = O_TRUNC; break;
       case 'T': rb_opts.timeout = parse_time_interval( arg ); break;
@@ -737,22 +889,59 @@ int main( const int argc, const char * const argv[] )
       case 'v': if( verbosity < 4 ) ++verbosity; break;
       case 'V': show_version(); return 0;
       case 'w': fb_opts.ignore_write_errors = true; break;
-      case 'x': rb_opts.min_outfile_size = getnum( arg, hardbs, 1 ); break;
+      case 'x': sector_args.push_back( argind ); break;
       case 'X': rb_opts.exit_on_error = true; break;
       case 'y': synchronous = true; break;
       case opt_ask: ask = true; break;
+      case opt_asy: rb_opts.async_logfile = true; break;
       case opt_cpa: parse_cpass( parser.argument( argind ), rb_opts ); break;
+      case opt_eng: set_io_engine( arg ); break;
+      case opt_gro: sector_args.push_back( argind ); synchronous = true;
+                    break;
+      case opt_jou: rb_opts.journal = true; break;
+      case opt_mmm: rb_opts.max_map_memory = getnum( arg, 0, 1 ); break;
       case opt_pau: rb_opts.pause = parse_time_interval( arg ); break;
-      case opt_rat: rb_opts.max_read_rate = getnum( arg, hardbs, 1 ); break;
+      case opt_pip: rb_opts.write_buffers = arg[0] ? getnum( arg, 0, 1, 1024 ) : 4;
+                    break;
+      case opt_rat: sector_args.push_back( argind ); break;
+      case opt_thr: rb_opts.threads = getnum( arg, 0, 1, 256 ); break;
+      case opt_uri: rb_opts.uring_depth = arg[0] ? getnum( arg, 0, 1, 1024 ) : 8;
+                    check_io_uring(); break;
+      case opt_zer: rb_opts.zero_copy = true; check_zero_copy(); break;
       default : internal_error( "uncaught option." );
       }
     } // end process options
 
-  if( opos < 0 ) opos = ipos;
-  if( hardbs < 1 ) hardbs = default_hardbs;
-  if( cluster >= INT_MAX / hardbs ) cluster = ( INT_MAX / hardbs ) - 1;
-  if( cluster < 1 ) cluster = cluster_bytes / hardbs;
-  if( cluster < 1 ) cluster = 1;
+  if( !io_backend->thread_safe() &&
+      ( rb_opts.threads > 1 || rb_opts.write_buffers > 0 ) )
+    {
+    show_error( ( rb_opts.threads > 1 ) ?
+                "Option '--threads' is incompatible with the I/O engine in use." :
+                "Option '--pipeline' is incompatible with the I/O engine in use.",
+                0, true );
+    return 1;
+    }
+  if( rb_opts.async_logfile && rb_opts.journal )
+    {
+    show_error( "Options '--async-logfile' and '--journal' are incompatible.",
+                0, true );
+    return 1;
+    }
+  if( rb_opts.threads > 1 && rb_opts.journal )
+    {
+    show_error( "Options '--threads' and '--journal' are incompatible.",
+                0, true );
+    return 1;
+    }
+  if( rb_opts.max_map_memory > 0 &&	// snapshots would read the whole map
+      ( rb_opts.async_logfile || rb_opts.threads > 1 ) )
+    {
+    show_error( rb_opts.async_logfile ?
+                "Options '--async-logfile' and '--max-map-memory' are incompatible." :
+                "Options '--threads' and '--max-map-memory' are incompatible.",
+                0, true );
+    return 1;
+    }
 
   const char *iname = 0, *oname = 0, *logname = 0;
   if( argind < parser.arguments() ) iname = parser.argument( argind++ ).c_str();
@@ -761,6 +950,47 @@ int main( const int argc, const char * const argv[] )
   if( argind < parser.arguments() )
     { show_error( "Too many files.", 0, true ); return 1; }
 
+  Device_topology topology;
+  bool topology_found = false;
+  if( program_mode == m_none && iname && ( !hardbs_given || cluster <= 0 ) )
+    {
+    const int fd = open( iname, O_RDONLY | O_BINARY );
+    if( fd >= 0 )
+      {
+      topology_found = device_topology( fd, topology );
+      close( fd );
+      if( topology_found )
+        topology_defaults( topology, hardbs_given, hardbs, cluster,
+                           cluster_bytes, max_hardbs );
+      }
+    }
+
+  if( hardbs < 1 ) hardbs = default_hardbs;
+  if( cluster >= INT_MAX / hardbs ) cluster = ( INT_MAX / hardbs ) - 1;
+  if( cluster < 1 ) cluster = cluster_bytes / hardbs;
+  if( cluster < 1 ) cluster = 1;
+  if( min_cluster >= cluster ) min_cluster = 0;
+
+  for( unsigned i = 0; i < sector_args.size(); ++i )	// numbers may be
+    {							// given in sectors
+    const int code = parser.code( sector_args[i] );
+    const char * const arg = parser.argument( sector_args[i] ).c_str();
+    switch( code )
+      {
+      case 'a': rb_opts.min_read_rate = getnum( arg, hardbs, 0 ); break;
+      case 'E': rb_opts.max_error_rate = getnum( arg, hardbs, 0 ); break;
+      case 'i': ipos = getnum( arg, hardbs, 0 ); break;
+      case 'K': parse_skipbs( arg, rb_opts, hardbs ); break;
+      case 'o': opos = getnum( arg, hardbs, 0 ); break;
+      case 's': max_size = getnum( arg, hardbs, -1 ); break;
+      case 'x': rb_opts.min_outfile_size = getnum( arg, hardbs, 1 ); break;
+      case opt_gro: parse_group_commit( arg, hardbs ); break;
+      case opt_rat: rb_opts.max_read_rate = getnum( arg, hardbs, 1 ); break;
+      default : internal_error( "uncaught option." );
+      }
+    }
+  if( opos < 0 ) opos = ipos;
+
   // end scan arguments
 
   if( !check_files( iname, oname, logname, rb_opts.min_outfile_size, force,
@@ -794,11 +1024,13 @@ int main( const int argc, const char * const argv[] )
       if( fb_opts != Fb_options() )
         { show_error( "Option '-w' is incompatible with rescue mode.", 0, true );
           return 1; }
+      rb_opts.min_copybs = min_cluster * hardbs;
       const Domain * const test_domain = test_mode_logfile_name ?
         new Domain( 0, -1, test_mode_logfile_name, loose ) : 0;
       int tmp = do_rescue( opos - ipos, domain, test_domain, rb_opts, iname,
                            oname, logname, cluster, hardbs, o_trunc, ask,
-                           preallocate, synchronous, verify_input_size );
+                           preallocate, synchronous, verify_input_size,
+                           topology_found ? &topology : 0 );
       if( test_domain ) delete test_domain;
       return tmp;
       }
@@ -19,9 +19,13 @@
 
 #include "non_posix.h"
 
+#include <cerrno>
+#include <climits>
+
 #ifdef USE_NON_POSIX
 #include <cctype>
 #include <string>
+#include <unistd.h>
 #include <sys/ioctl.h>
 
 namespace {
@@ -56,7 +60,20 @@ const char * device_id( const int fd )
   return id_str.c_str();
   }
 
+
+bool device_topology( const int, Device_topology & ) { return false; }
+
+int copy_range( const int, const long long, const int, const long long,
+                const int )
+  { errno = ENOSYS; return -1; }
+
+bool copy_range_available() { return false; }
+
 #else				// use linux by default
+#include <cstdio>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <linux/fs.h>
 #include <linux/hdreg.h>
 
 const char * device_id( const int fd )
@@ -74,10 +91,84 @@ const char * device_id( const int fd )
   return 0;
   }
 
+
+bool device_topology( const int fd, Device_topology & dt )
+  {
+  struct stat st;
+  int lsize = 0;
+  if( fstat( fd, &st ) != 0 || !S_ISBLK( st.st_mode ) ||
+      ioctl( fd, BLKSSZGET, &lsize ) != 0 || lsize <= 0 ) return false;
+  dt = Device_topology();
+  dt.logical_size = lsize;
+  unsigned val;
+#ifdef BLKPBSZGET
+  if( ioctl( fd, BLKPBSZGET, &val ) == 0 && val <= INT_MAX )
+    dt.physical_size = val;
+#endif
+#ifdef BLKIOMIN
+  if( ioctl( fd, BLKIOMIN, &val ) == 0 && val <= INT_MAX ) dt.io_min = val;
+#endif
+#ifdef BLKIOOPT
+  if( ioctl( fd, BLKIOOPT, &val ) == 0 && val <= INT_MAX ) dt.io_opt = val;
+#endif
+  // partitions have no queue directory; use the one of the whole disc
+  const char * const fmt[2] = { "/sys/dev/block/%u:%u/queue/max_sectors_kb",
+                                "/sys/dev/block/%u:%u/../queue/max_sectors_kb" };
+  for( int i = 0; i < 2; ++i )
+    {
+    char path[80];
+    snprintf( path, sizeof path, fmt[i], major( st.st_rdev ),
+              minor( st.st_rdev ) );
+    std::FILE * const f = std::fopen( path, "r" );
+    if( !f ) continue;
+    if( std::fscanf( f, "%u", &val ) == 1 && val > 0 && val <= INT_MAX / 1024 )
+      dt.max_io = val * 1024;
+    std::fclose( f );
+    break;
+    }
+  return true;
+  }
+
+#include <sys/syscall.h>
+
+#ifdef __NR_copy_file_range
+int copy_range( const int ifd, const long long ipos, const int ofd,
+                const long long opos, const int size )
+  {
+  long long ioff = ipos, ooff = opos;	// loff_t
+  int sz = 0;
+  while( sz < size )
+    {
+    const long n = syscall( __NR_copy_file_range, ifd, &ioff, ofd, &ooff,
+                            (size_t)( size - sz ), 0U );
+    if( n > 0 ) sz += n;
+    else if( n == 0 ) break;				// EOF
+    else if( errno != EINTR ) { if( sz == 0 ) return -1; break; }
+    }
+  return sz;
+  }
+
+bool copy_range_available() { return true; }
+#else
+int copy_range( const int, const long long, const int, const long long,
+                const int )
+  { errno = ENOSYS; return -1; }
+
+bool copy_range_available() { return false; }
+#endif
+
 #endif
 
 #else	// USE_NON_POSIX
 
 const char * device_id( const int ) { return 0; }
 
+bool device_topology( const int, Device_topology & ) { return false; }
+
+int copy_range( const int, const long long, const int, const long long,
+                const int )
+  { errno = ENOSYS; return -1; }
+
+bool copy_range_available() { return false; }
+
 #endif
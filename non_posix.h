@@ -16,3 +16,26 @@
 */
 
 const char * device_id( const int fd );
+
+struct Device_topology			// sizes in bytes, 0 = unknown
+  {
+  int logical_size;			// logical sector size
+  int physical_size;			// physical sector size
+  int io_min;				// minimum preferred I/O size
+  int io_opt;				// optimal I/O size
+  int max_io;				// largest I/O request (max_sectors_kb)
+
+  Device_topology()
+    : logical_size( 0 ), physical_size( 0 ), io_min( 0 ), io_opt( 0 ),
+      max_io( 0 ) {}
+  };
+
+// Returns false if 'fd' is not a block device or its topology is unknown.
+bool device_topology( const int fd, Device_topology & dt );
+
+// Copy 'size' bytes from 'ifd' at 'ipos' to 'ofd' at 'opos' without
+// passing them through user space. Returns the number of bytes copied,
+// or -1 and sets errno (ENOSYS if not available).
+int copy_range( const int ifd, const long long ipos, const int ofd,
+                const long long opos, const int size );
+bool copy_range_available();
@@ -26,24 +26,73 @@
 #include <ctime>
 #include <string>
 #include <vector>
+#include <pthread.h>
 #include <stdint.h>
 #include <unistd.h>
 #include <sys/stat.h>
 
 #include "block.h"
 #include "ddrescue.h"
+#include "io_backend.h"
 #include "loggers.h"
+#include "uring.h"
+#include "saver.h"
+#include "writer.h"
+#include "zero.h"
+
+
+struct Stripe_set			// state shared by the threads of tcopy
+  {
+  pthread_mutex_t mutex;		// protects the logfile and this struct
+  pthread_mutex_t log_mutex;		// protects read_logger
+  pthread_mutex_t commit_mutex;		// protects commit
+  pthread_cond_t done_cond;		// signals the end of a thread
+  long long eof_pos;			// lowest EOF found, or -1
+  long long recsize, errsize, error_rate;	// not yet added to Rescuebook
+  int errors;
+  int running;				// threads not yet finished
+  int retval;				// 1 if a thread found a write error
+  bool error_exit;			// a thread found an error with -X
+  bool slow_read;			// copy of Rescuebook::slow_read()
+  bool stop;
+  };
+
+struct Stripe				// state of each thread of tcopy
+  {
+  Stripe_set * set;
+  Rescuebook * rb;
+  long long pos, end;			// next pos to read, end of stripe
+  uint8_t * buf_base, * buf;		// buffer of softbs bytes, aligned
+  pthread_t thread;
+  int skip_size;			// size to skip on error if skipbs > 0
+  bool started;
+  };
+
+
+namespace {
+
+extern "C" void * stripe_thread( void * arg )
+  {
+  Stripe * const s = static_cast< Stripe * >( arg );
+  s->rb->copy_stripe( *s );
+  return 0;
+  }
+
+} // end namespace
 
 
 void Rescuebook::count_errors()
   {
+  if( domain().includes( extent() ) )	// all the sblocks are in domain
+    { errors = status_runs( Sblock::bad_sector ); return; }
   bool good = true;
+  int dcursor = 0;			// cursor for domain lookups
   errors = 0;
 
   for( int i = 0; i < sblocks(); ++i )
     {
     const Sblock & sb = sblock( i );
-    if( !domain().includes( sb ) )
+    if( !domain().includes( sb, dcursor ) )
       { if( domain() < sb ) break; else { good = true; continue; } }
     switch( sb.status() )
       {
@@ -57,6 +106,24 @@ void Rescuebook::count_errors()
   }
 
 
+// Change to 'new_st' the status of the sblocks in domain with status
+// 'old_st'. Only the sblocks with status 'old_st' are visited.
+//
+void Rescuebook::replace_status( const Sblock::Status old_st,
+                                 const Sblock::Status new_st )
+  {
+  int dcursor = 0;
+  for( int index = find_sblock( 0, old_st ); index >= 0;
+       index = find_sblock( index + 1, old_st ) )
+    {
+    const Sblock sb = sblock( index );
+    if( !domain().includes( sb, dcursor ) )
+      { if( domain() < sb ) break; else continue; }
+    change_sblock_status( index, new_st );
+    }
+  }
+
+
 // Return values: 1 I/O error, 0 OK, -1 interrupted.
 //
 int Rescuebook::copy_and_update( const Block & b, int & copied_size,
@@ -74,16 +141,18 @@ int Rescuebook::copy_and_update( const Block & b, int & copied_size,
   show_status( b.pos(), msg );
   if( errors_or_timeout() ) return 1;
   if( interrupted() ) return -1;
-  int retval = copy_block( b, copied_size, error_size );
+  bool write_queued = false;
+  int retval = copy_block( b, copied_size, error_size, write_queued );
   if( retval == 0 )
     {
+    if( error_size == 0 && copied_size == b.size() ) ra_stopped = false;
     if( copied_size + error_size < b.size() )			// EOF
       {
       if( complete_only ) truncate_domain( b.pos() + copied_size + error_size );
       else if( !truncate_vector( b.pos() + copied_size + error_size ) )
         { final_msg( "EOF found before end of logfile" ); retval = 1; }
       }
-    if( copied_size > 0 )
+    if( copied_size > 0 && !write_queued )	// else done by reap_writes
       {
       errors += change_chunk_status( Block( b.pos(), copied_size ),
                                      Sblock::finished, domain() );
@@ -92,6 +161,7 @@ int Rescuebook::copy_and_update( const Block & b, int & copied_size,
       }
     if( error_size > 0 )
       {
+      if( uring ) { ra_stopped = true; uring->clear(); }
       error_rate += error_size;
       const Sblock::Status st2 =
         ( error_size > hardbs() ) ? st : Sblock::bad_sector;
@@ -108,6 +178,81 @@ int Rescuebook::copy_and_update( const Block & b, int & copied_size,
   }
 
 
+// Return values: 1 write error, 0 OK.
+// Mark as finished the blocks already written by the writer thread.
+// Waits for the oldest write if the queue is full, or for all the writes
+// if 'drain' is true.
+//
+int Rescuebook::reap_writes( const bool drain )
+  {
+  int retval = 0;
+  long long pos;
+  int size, error;
+  while( writer->pop( pos, size, error, drain || writer->full() ) )
+    {
+    if( error )
+      {
+      if( retval == 0 ) final_msg( "Write error", error );
+      retval = 1; continue;
+      }
+    errors += change_chunk_status( Block( pos, size ), Sblock::finished,
+                                   domain() );
+    recsize += size;
+    }
+  return retval;
+  }
+
+
+// Keep the read queue filled with the blocks that the copying pass is
+// going to read after 'b'. The blocks are found the same way as in
+// fcopy_non_tried and rcopy_non_tried. The queue is restarted at 'b' if
+// 'b' is not the first block in queue (because of a skip, for example).
+// Nothing is queued after a read error until a whole block is read
+// without errors, so that no reads are queued on the damaged area.
+//
+void Rescuebook::queue_reads( const Block & b, const bool forward )
+  {
+  if( !uring ) return;
+  if( !uring->front_is( ides_, b.pos(), b.size() ) )
+    { uring->clear(); ra_pos = forward ? b.pos() : b.end(); }
+  while( ra_pos >= 0 && !ra_stopped && !uring->full() )
+    {
+    Block rb( 0, 0 );
+    if( forward )
+      {
+      rb.assign( ra_pos, copybs );
+      find_chunk( rb, Sblock::non_tried, domain(), copybs );
+      }
+    else if( ra_pos > 0 )
+      {
+      rb.assign( ra_pos - copybs, copybs );
+      rfind_chunk( rb, Sblock::non_tried, domain(), copybs );
+      }
+    if( rb.size() <= 0 ) { ra_pos = -1; break; }
+    if( !uring->push( ides_, rb.pos(), rb.size() ) ) break;	// retry later
+    ra_pos = forward ? rb.end() : rb.pos();
+    }
+  }
+
+
+// Adjust the size of copy blocks between min_copybs and softbs().
+// Shrink it to the minimum after a read error. Else, once per update of
+// rates, halve it if the current rate is less than half the average
+// rate, or double it if not.
+//
+void Rescuebook::adapt_copybs( const int error_size )
+  {
+  if( min_copybs <= 0 ) return;
+  if( error_size > 0 ) { copybs = min_copybs; copybs_t = t1; return; }
+  if( t1 <= copybs_t ) return;			// rates not yet updated
+  copybs_t = t1;
+  if( c_rate < a_rate / 2 )
+    copybs = std::max( round_up( copybs / 2, hardbs() ), min_copybs );
+  else if( copybs <= softbs() / 2 ) copybs *= 2;
+  else copybs = softbs();
+  }
+
+
 bool Rescuebook::update_and_pause()
   {
   if( pause <= 0 || just_paused ) return true;
@@ -138,8 +283,15 @@ int Rescuebook::copy_non_tried()
       update_and_pause();
       snprintf( msgbuf + msglen, ( sizeof msgbuf ) - msglen, "%d %s",
                 pass, forward ? "(forwards)" : "(backwards)" );
-      int retval = forward ? fcopy_non_tried( msgbuf, pass ) :
-                             rcopy_non_tried( msgbuf, pass );
+      if( min_copybs > 0 )	// later passes read near the skipped areas
+        copybs = ( pass == 1 ) ? softbs() : min_copybs;
+      int retval;
+      if( forward && pass == 1 && threads > 1 && !domain().full() )
+        retval = tcopy_non_tried( msgbuf );
+      else retval = forward ? fcopy_non_tried( msgbuf, pass ) :
+                              rcopy_non_tried( msgbuf, pass );
+      if( uring ) uring->clear();
+      if( writer && reap_writes( true ) != 0 ) retval = 1;
       if( retval != -3 ) return retval;
       reduce_min_read_rate();
       }
@@ -169,17 +321,20 @@ int Rescuebook::fcopy_non_tried( const char * const msg, const int pass )
 
   while( pos >= 0 )
     {
-    Block b( pos, softbs() );
-    find_chunk( b, Sblock::non_tried, domain(), softbs() );
+    Block b( pos, copybs );
+    find_chunk( b, Sblock::non_tried, domain(), copybs );
     if( b.size() <= 0 ) break;
+    extend_to_hole( b );
     if( pos != b.pos() ) skip_size = skipbs;	// reset size on block change
     pos = b.end();
     block_found = true;
     int copied_size = 0, error_size = 0;
+    queue_reads( b, true );
     const int retval = copy_and_update( b, copied_size, error_size, msg,
                                         copying, true, Sblock::non_trimmed );
     if( retval ) return retval;
     update_rates();
+    adapt_copybs( error_size );
     if( error_size > 0 && exit_on_error ) { e_code |= 2; return 1; }
     if( ( error_size > 0 || slow_read() ) && pos >= 0 )
       {
@@ -221,17 +376,19 @@ int Rescuebook::rcopy_non_tried( const char * const msg, const int pass )
 
   while( end > 0 )
     {
-    Block b( end - softbs(), softbs() );
-    rfind_chunk( b, Sblock::non_tried, domain(), softbs() );
+    Block b( end - copybs, copybs );
+    rfind_chunk( b, Sblock::non_tried, domain(), copybs );
     if( b.size() <= 0 ) break;
     if( end != b.end() ) skip_size = skipbs;	// reset size on block change
     end = b.pos();
     block_found = true;
     int copied_size = 0, error_size = 0;
+    queue_reads( b, false );
     const int retval = copy_and_update( b, copied_size, error_size, msg,
                                         copying, false, Sblock::non_trimmed );
     if( retval ) return retval;
     update_rates();
+    adapt_copybs( error_size );
     if( error_size > 0 && exit_on_error ) { e_code |= 2; return 1; }
     if( ( error_size > 0 || slow_read() ) && end > 0 )
       {
@@ -253,6 +410,233 @@ int Rescuebook::rcopy_non_tried( const char * const msg, const int pass )
   }
 
 
+// Return values: 1 I/O error, 0 OK, -1 interrupted, -2 logfile error.
+// Read forwards the non-tried part of the domain using 'threads' threads.
+// The domain is divided in stripes, and each thread reads its own stripe
+// like fcopy_non_tried. The main thread shows the status and updates the
+// logfile, whose current_pos is the lowest position not yet read, so that
+// the rescue can be resumed by a single-threaded run.
+// The main thread holds the mutex only to copy the counters and to take
+// snapshots of the logfile; the rates are updated, the status is shown and
+// the snapshots are written with the mutex unlocked. The threads only wait
+// while the map is copied for each snapshot.
+//
+int Rescuebook::tcopy_non_tried( const char * const msg )
+  {
+  Block b( domain().pos(), 1 );
+  find_chunk( b, Sblock::non_tried, domain(), hardbs() );
+  if( b.size() <= 0 ) return 0;			// no block found
+  if( saver && !saver->wait() && !update_logfile( odes_, true ) ) return -2;
+
+  long long stripe_size = ( domain().end() - domain().pos() ) / threads;
+  if( stripe_size % softbs() ) stripe_size += softbs() - stripe_size % softbs();
+  if( stripe_size <= 0 ) stripe_size = softbs();
+  const int alignment = std::max( this->alignment(), 1 );
+  Stripe_set set;
+  pthread_mutex_init( &set.mutex, 0 );
+  pthread_mutex_init( &set.log_mutex, 0 );
+  pthread_mutex_init( &set.commit_mutex, 0 );
+  pthread_cond_init( &set.done_cond, 0 );
+  set.eof_pos = -1; set.recsize = 0; set.errsize = 0; set.error_rate = 0;
+  set.errors = 0; set.running = 0; set.retval = 0; set.error_exit = false;
+  set.slow_read = false; set.stop = false;
+  std::vector< Stripe > stripes( threads );
+
+  just_paused = false;
+  if( first_post )
+    {
+    current_status( copying, msg );
+    read_logger.print_msg( t1 - t0, msg );
+    }
+  current_pos( b.pos() );
+  show_status( b.pos(), msg );
+  pthread_mutex_lock( &set.mutex );
+  for( unsigned i = 0; i < stripes.size(); ++i )
+    {
+    Stripe & s = stripes[i];
+    s.set = &set; s.rb = this; s.buf_base = s.buf = 0; s.started = false;
+    s.pos = domain().pos() + i * stripe_size;
+    s.end = std::min( s.pos + stripe_size, domain().end() );
+    s.skip_size = skipbs;
+    if( s.pos >= s.end ) continue;
+    s.buf = s.buf_base = new uint8_t[ softbs() + alignment ];
+    const int disp = alignment - ( reinterpret_cast<long> (s.buf) % alignment );
+    if( disp > 0 && disp < alignment ) s.buf += disp;
+    s.started = ( pthread_create( &s.thread, 0, stripe_thread, &s ) == 0 );
+    if( s.started ) ++set.running;
+    else show_error( "warning: Can't start thread. Stripe left for later passes." );
+    }
+
+  int retval = 0;
+  bool save_failed = false;		// update the logfile after the pass
+  while( set.running > 0 )
+    {
+    struct timespec ts;			// wake up every second
+    clock_gettime( CLOCK_REALTIME, &ts ); ts.tv_sec += 1;
+    pthread_cond_timedwait( &set.done_cond, &set.mutex, &ts );
+    long long pos = LLONG_MAX;		// lowest position not yet read
+    for( unsigned i = 0; i < stripes.size(); ++i )
+      if( stripes[i].started && stripes[i].pos < stripes[i].end )
+        pos = std::min( pos, stripes[i].pos );
+    if( pos < LLONG_MAX ) current_pos( pos );
+    add_stripe_counters( set );
+    if( retval || save_failed ) set.stop = true;
+    Logfile * const snapshot =
+      ( !set.stop && filename() && logfile_due() ) ? new Logfile( *this ) : 0;
+    pos = current_pos();
+    pthread_mutex_unlock( &set.mutex );
+
+    update_rates();			// may sleep if max_read_rate > 0
+    if( retval == 0 && errors_or_timeout() ) retval = 1;
+    if( retval == 0 && interrupted() ) retval = -1;
+    const bool log_reads = read_logger.active();
+    if( log_reads ) pthread_mutex_lock( &set.log_mutex );
+    show_status( pos, msg );
+    if( log_reads ) pthread_mutex_unlock( &set.log_mutex );
+    if( snapshot )
+      {
+      if( odes_ >= 0 ) fsync( odes_ );
+      if( !snapshot->replace_logfile( true ) ) save_failed = true;
+      delete snapshot;
+      }
+    pthread_mutex_lock( &set.mutex );
+    set.slow_read = slow_read();
+    if( retval ) set.stop = true;
+    }
+  pthread_mutex_unlock( &set.mutex );
+
+  for( unsigned i = 0; i < stripes.size(); ++i )
+    {
+    if( stripes[i].started ) pthread_join( stripes[i].thread, 0 );
+    delete[] stripes[i].buf_base;
+    }
+  add_stripe_counters( set );
+  pthread_cond_destroy( &set.done_cond );
+  pthread_mutex_destroy( &set.commit_mutex );
+  pthread_mutex_destroy( &set.log_mutex );
+  pthread_mutex_destroy( &set.mutex );
+  if( set.retval ) retval = set.retval;
+  if( retval == 0 && errors_or_timeout() ) retval = 1;
+  if( retval == 0 && set.eof_pos >= 0 )
+    {
+    if( complete_only ) truncate_domain( set.eof_pos );
+    else if( !truncate_vector( set.eof_pos ) )
+      { final_msg( "EOF found before end of logfile" ); retval = 1; }
+    }
+  if( retval ) return retval;
+  if( !update_logfile( odes_, save_failed ) ) return -2;
+  return -3;
+  }
+
+
+// Add to the counters of Rescuebook the ones accumulated by the threads
+// of tcopy, so that the counters shown are only accessed by the main
+// thread. Called with the mutex locked or after the threads have ended.
+//
+void Rescuebook::add_stripe_counters( Stripe_set & set )
+  {
+  recsize += set.recsize; errsize += set.errsize;
+  error_rate += set.error_rate; errors += set.errors;
+  set.recsize = 0; set.errsize = 0; set.error_rate = 0; set.errors = 0;
+  if( set.error_exit ) e_code |= 2;
+  }
+
+
+// Read the non-tried chunks of stripe 's', skipping over the damaged
+// areas. Data are read, written and synced with the mutex unlocked; the
+// logfile and the counters of the set are only accessed with the mutex
+// locked.
+//
+void Rescuebook::copy_stripe( Stripe & s )
+  {
+  Stripe_set & set = *s.set;
+  pthread_mutex_lock( &set.mutex );
+  while( !set.stop && s.pos < s.end )
+    {
+    Block b( s.pos, softbs() );
+    find_chunk( b, Sblock::non_tried, domain(), softbs() );
+    if( b.size() <= 0 || b.pos() >= s.end ) break;
+    if( b.end() > s.end ) b.size( s.end - b.pos() );
+    if( s.pos != b.pos() ) s.skip_size = skipbs;	// reset size on block change
+    s.pos = b.end();
+    pthread_mutex_unlock( &set.mutex );
+
+    int copied_size = 0, error_size = 0, write_errno = 0;
+    if( !test_domain || test_domain->includes( b ) )
+      {
+      copied_size = io_backend->readblock( ides_, s.buf, b.size(), b.pos() );
+      error_size = errno ? b.size() - copied_size : 0;
+      }
+    else error_size = b.size();
+    const bool zero = ( copied_size > 0 && sparse &&	// sparse_size >= 0
+                        block_is_zero( s.buf, copied_size ) );
+    if( copied_size > 0 && !zero &&
+        io_backend->writeblock( odes_, s.buf, copied_size,
+                                b.pos() + offset() ) != copied_size )
+      write_errno = errno ? errno : EIO;
+
+    if( copied_size > 0 && !zero && !write_errno && synchronous_ )
+      {						// sync before marking finished
+      pthread_mutex_lock( &set.commit_mutex );
+      if( !commit.written( odes_, copied_size ) ) write_errno = errno;
+      pthread_mutex_unlock( &set.commit_mutex );
+      }
+    pthread_mutex_lock( &set.log_mutex );
+    read_logger.print_line( b.pos(), b.size(), copied_size, error_size );
+    pthread_mutex_unlock( &set.log_mutex );
+    pthread_mutex_lock( &set.mutex );
+    if( write_errno )
+      {
+      if( set.retval == 0 ) final_msg( "Write error", write_errno );
+      set.retval = 1; set.stop = true; break;
+      }
+    if( copied_size > 0 )
+      {
+      if( zero && b.pos() + offset() + copied_size > sparse_size )
+        sparse_size = b.pos() + offset() + copied_size;
+      set.errors += change_chunk_status( Block( b.pos(), copied_size ),
+                                         Sblock::finished, domain() );
+      set.recsize += copied_size;
+      }
+    if( error_size > 0 )
+      {
+      set.error_rate += error_size;
+      const Sblock::Status st = ( error_size > hardbs() ) ?
+                                Sblock::non_trimmed : Sblock::bad_sector;
+      set.errors += change_chunk_status( Block( b.pos() + copied_size,
+                                                error_size ), st, domain() );
+      if( st == Sblock::bad_sector ) set.errsize += error_size;
+      struct stat st2;
+      if( stat( iname_, &st2 ) != 0 )
+        {
+        if( set.retval == 0 ) final_msg( "Input file disappeared", errno );
+        set.retval = 1; set.stop = true; break;
+        }
+      if( exit_on_error ) { set.error_exit = true; set.stop = true; break; }
+      }
+    if( copied_size + error_size < b.size() )			// EOF
+      {
+      const long long end = b.pos() + copied_size + error_size;
+      if( set.eof_pos < 0 || end < set.eof_pos ) set.eof_pos = end;
+      break;
+      }
+    if( ( error_size > 0 || set.slow_read ) && skipbs > 0 && s.pos < s.end )
+      {
+      b.assign( s.pos, s.skip_size );
+      find_chunk( b, Sblock::non_tried, domain(), hardbs() );
+      if( s.pos == b.pos() && b.size() > 0 )
+        s.pos = std::min( b.end(), s.end );			// skip
+      if( s.skip_size <= max_skipbs / 2 ) s.skip_size *= 2;
+      else s.skip_size = max_skipbs;
+      }
+    else if( copied_size > 0 ) s.skip_size = skipbs;		// reset
+    }
+  --set.running;
+  pthread_cond_signal( &set.done_cond );
+  pthread_mutex_unlock( &set.mutex );
+  }
+
+
 // Return values: 1 I/O error, 0 OK, -1 interrupted, -2 logfile error.
 // Trim both edges of each damaged area sequentially.
 //
@@ -263,10 +647,11 @@ int Rescuebook::trim_errors()
   first_post = true;
   update_and_pause();
 
+  int dcursor = 0;
   for( int i = 0; i < sblocks(); )
     {
     const Sblock sb = sblock( reverse ? sblocks() - i - 1 : i );
-    if( !domain().includes( sb ) )
+    if( !domain().includes( sb, dcursor ) )
       { if( ( !reverse && domain() < sb ) || ( reverse && domain() > sb ) )
           break;
         ++i; continue; }
@@ -325,10 +710,11 @@ int Rescuebook::scrape_errors()
   first_post = true;
   update_and_pause();
 
+  int dcursor = 0;
   for( int i = 0; i < sblocks(); )
     {
     const Sblock sb = sblock( reverse ? sblocks() - i - 1 : i );
-    if( !domain().includes( sb ) )
+    if( !domain().includes( sb, dcursor ) )
       { if( ( !reverse && domain() < sb ) || ( reverse && domain() > sb ) )
           break;
         ++i; continue; }
@@ -569,8 +955,10 @@ Rescuebook::Rescuebook( const long long offset, const long long isize,
                         Domain & dom, const Domain * const test_dom,
                         const Rb_options & rb_opts, const char * const iname,
                         const char * const logname, const int cluster,
-                        const int hardbs, const bool synchronous )
-  : Logbook( offset, isize, dom, logname, cluster, hardbs, rb_opts.complete_only ),
+                        const int hardbs, const int min_alignment,
+                        const bool synchronous )
+  : Logbook( offset, isize, dom, logname, cluster, hardbs, min_alignment,
+             rb_opts.complete_only, rb_opts.max_map_memory ),
     Rb_options( rb_opts ),
     error_rate( 0 ),
     sparse_size( sparse ? 0 : -1 ),
@@ -580,12 +968,26 @@ Rescuebook::Rescuebook( const long long offset, const long long isize,
     iname_( iname ),
     e_code( 0 ),
     synchronous_( synchronous ),
+    copybs( softbs() ), copybs_t( 0 ),
     a_rate( 0 ), c_rate( 0 ), first_size( 0 ), last_size( 0 ),
-    iobuf_ipos( -1 ), last_ipos( 0 ), t0( 0 ), t1( 0 ), ts( 0 ), oldlen( 0 ),
-    rates_updated( false ), sliding_avg( 30 ), first_post( false ),
-    just_paused( true )
+    iobuf_ipos( -1 ), ra_pos( -1 ), ra_stopped( false ), uring( 0 ),
+    writer( 0 ), saver( 0 ),
+    hole_cache( 0, 0 ), data_cache( 0, 0 ), seek_holes( false ),
+    last_ipos( 0 ), t0( 0 ), t1( 0 ), ts( 0 ), oldlen( 0 ), rates_updated( false ),
+    sliding_avg( 30 ), first_post( false ), just_paused( true )
   {
   if( preview_lines > softbs() / 16 ) preview_lines = softbs() / 16;
+  if( min_copybs >= softbs() ) min_copybs = 0;	// fixed size
+  if( journal && filename() ) start_journal();
+  if( uring_depth > 0 )
+    {
+    uring = new Uring_reader( uring_depth, softbs(), alignment() );
+    if( !uring->ok() )
+      {
+      delete uring; uring = 0;
+      show_error( "warning: Can't set up io_uring. Reading synchronously." );
+      }
+    }
   const long long csize = isize / 100;
   if( isize > 0 && skipbs > 0 && max_skipbs == Rb_options::max_max_skipbs &&
       csize < max_skipbs )
@@ -594,48 +996,78 @@ Rescuebook::Rescuebook( const long long offset, const long long isize,
   max_skipbs = round_up( max_skipbs, hardbs );
 
   if( retrim )
-    for( int index = 0; index < sblocks(); ++index )
-      {
-      const Sblock & sb = sblock( index );
-      if( !domain().includes( sb ) )
-        { if( domain() < sb ) break; else continue; }
-      if( sb.status() == Sblock::non_scraped ||
-          sb.status() == Sblock::bad_sector )
-        change_sblock_status( index, Sblock::non_trimmed );
-      }
+    {
+    replace_status( Sblock::non_scraped, Sblock::non_trimmed );
+    replace_status( Sblock::bad_sector, Sblock::non_trimmed );
+    }
   if( try_again )
-    for( int index = 0; index < sblocks(); ++index )
-      {
-      const Sblock & sb = sblock( index );
-      if( !domain().includes( sb ) )
-        { if( domain() < sb ) break; else continue; }
-      if( sb.status() == Sblock::non_scraped ||
-          sb.status() == Sblock::non_trimmed )
-        change_sblock_status( index, Sblock::non_tried );
-      }
+    {
+    replace_status( Sblock::non_scraped, Sblock::non_tried );
+    replace_status( Sblock::non_trimmed, Sblock::non_tried );
+    }
   count_errors();
   if( new_errors_only ) max_errors += errors;
   }
 
 
+Rescuebook::~Rescuebook() { delete saver; delete writer; delete uring; }
+
+
 // Return values: 1 I/O error, 0 OK.
 //
 int Rescuebook::do_rescue( const int ides, const int odes )
   {
   bool copy_pending = false, trim_pending = false, scrape_pending = false;
   ides_ = ides; odes_ = odes;
+  struct stat st;			// holes of test files are not simulated
+  seek_holes = ( !test_domain && fstat( ides_, &st ) == 0 &&
+                 S_ISREG( st.st_mode ) );
+  if( write_buffers > 0 )
+    {
+    writer = new Block_writer( odes_, offset(), synchronous_, write_buffers,
+                               softbs(), alignment() );
+    if( !writer->ok() )
+      {
+      delete writer; writer = 0;
+      show_error( "warning: Can't start writer thread. Writing synchronously." );
+      }
+    }
+  if( async_logfile && filename() && !journaling() )
+    {
+    saver = new Logfile_saver;
+    if( saver->ok() ) logfile_saver( saver );
+    else
+      {
+      delete saver; saver = 0;
+      show_error( "warning: Can't start saver thread. Saving logfile synchronously." );
+      }
+    }
 
-  for( int i = 0; i < sblocks(); ++i )
+  if( domain().includes( extent() ) )	// use the status counters
     {
-    const Sblock & sb = sblock( i );
-    if( !domain().includes( sb ) ) { if( domain() < sb ) break; else continue; }
-    switch( sb.status() )
+    copy_pending = ( status_count( Sblock::non_tried ) > 0 );
+    trim_pending = ( copy_pending || status_count( Sblock::non_trimmed ) > 0 );
+    scrape_pending = ( trim_pending ||
+                       status_count( Sblock::non_scraped ) > 0 );
+    errsize += status_size( Sblock::bad_sector );
+    recsize += status_size( Sblock::finished );
+    }
+  else
+    {
+    int dcursor = 0;
+    for( int i = 0; i < sblocks(); ++i )
       {
-      case Sblock::non_tried:   copy_pending = true;	// fall through
-      case Sblock::non_trimmed: trim_pending = true;	// fall through
-      case Sblock::non_scraped: scrape_pending = true; break;
-      case Sblock::bad_sector:  errsize += sb.size(); break;
-      case Sblock::finished:    recsize += sb.size(); break;
+      const Sblock & sb = sblock( i );
+      if( !domain().includes( sb, dcursor ) )
+        { if( domain() < sb ) break; else continue; }
+      switch( sb.status() )
+        {
+        case Sblock::non_tried:   copy_pending = true;	// fall through
+        case Sblock::non_trimmed: trim_pending = true;	// fall through
+        case Sblock::non_scraped: scrape_pending = true; break;
+        case Sblock::bad_sector:  errsize += sb.size(); break;
+        case Sblock::finished:    recsize += sb.size(); break;
+        }
       }
     }
   set_signals();
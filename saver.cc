@@ -0,0 +1,131 @@
+/*  GNU ddrescue - Data recovery tool
+    Copyright (C) 2015 Antonio Diaz Diaz.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _FILE_OFFSET_BITS 64
+
+#include <cerrno>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "block.h"
+#include "saver.h"
+
+
+namespace {
+
+extern "C" void * saver_thread( void * arg )
+  {
+  static_cast< Logfile_saver * >( arg )->save_snapshots();
+  return 0;
+  }
+
+} // end namespace
+
+
+Logfile_saver::Logfile_saver()
+  : pending( 0 ), pending_odes( -1 ), error_( 0 ), busy( false ),
+    stop( false ), ok_( false )
+  {
+  pthread_mutex_init( &mutex, 0 );
+  pthread_cond_init( &work_cond, 0 );
+  pthread_cond_init( &done_cond, 0 );
+  ok_ = ( pthread_create( &thread, 0, saver_thread, this ) == 0 );
+  }
+
+
+// Saves the snapshot still pending before stopping the thread.
+//
+Logfile_saver::~Logfile_saver()
+  {
+  if( ok_ )
+    {
+    pthread_mutex_lock( &mutex );
+    stop = true;
+    pthread_cond_signal( &work_cond );
+    pthread_mutex_unlock( &mutex );
+    pthread_join( thread, 0 );
+    }
+  delete pending;
+  pthread_cond_destroy( &done_cond );
+  pthread_cond_destroy( &work_cond );
+  pthread_mutex_destroy( &mutex );
+  }
+
+
+// Queues a copy of 'logfile' to be saved after syncing 'odes'. The copy
+// is made by the calling thread, before locking the mutex.
+// Returns false and sets errno if the previous save failed.
+//
+bool Logfile_saver::save( const Logfile & logfile, const int odes )
+  {
+  pthread_mutex_lock( &mutex );
+  const int e = error_; error_ = 0;
+  pthread_mutex_unlock( &mutex );
+  if( e ) { errno = e; return false; }
+  Logfile * const snapshot = new Logfile( logfile );	// copy outside lock
+  pthread_mutex_lock( &mutex );
+  delete pending;				// replaced by newer snapshot
+  pending = snapshot; pending_odes = odes;
+  pthread_cond_signal( &work_cond );
+  pthread_mutex_unlock( &mutex );
+  return true;
+  }
+
+
+// Waits until all snapshots queued have been saved.
+// Returns false and sets errno if the last save failed.
+//
+bool Logfile_saver::wait()
+  {
+  pthread_mutex_lock( &mutex );
+  while( pending || busy ) pthread_cond_wait( &done_cond, &mutex );
+  const int e = error_; error_ = 0;
+  pthread_mutex_unlock( &mutex );
+  if( e ) { errno = e; return false; }
+  return true;
+  }
+
+
+void Logfile_saver::save_snapshots()
+  {
+  pthread_mutex_lock( &mutex );
+  while( true )
+    {
+    while( !pending && !stop ) pthread_cond_wait( &work_cond, &mutex );
+    if( !pending ) break;
+    Logfile * const snapshot = pending;
+    const int odes = pending_odes;
+    pending = 0; busy = true;
+    pthread_mutex_unlock( &mutex );
+
+    if( odes >= 0 ) fsync( odes );
+    errno = 0;
+    const bool ok = snapshot->replace_logfile( true );
+    const int e = errno;
+    delete snapshot;
+
+    pthread_mutex_lock( &mutex );
+    busy = false;
+    if( !ok ) error_ = e ? e : EIO;
+    pthread_cond_broadcast( &done_cond );
+    }
+  pthread_mutex_unlock( &mutex );
+  }
@@ -0,0 +1,48 @@
+/*  GNU ddrescue - Data recovery tool
+    Copyright (C) 2015 Antonio Diaz Diaz.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Thread saving snapshots of the logfile in the background, so that the
+// rescue does not wait for the logfile to be written. If a new snapshot
+// arrives while the previous one is being saved, only the newest one
+// pending is saved.
+//
+class Logfile_saver
+  {
+  Logfile * pending;			// snapshot waiting to be saved, or 0
+  int pending_odes;			// outfile to sync before saving
+  int error_;				// errno of last failed save, or 0
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t work_cond;		// signals new snapshot or stop
+  pthread_cond_t done_cond;		// signals snapshot saved
+  bool busy;				// thread is saving a snapshot
+  bool stop;
+  bool ok_;
+
+  Logfile_saver( const Logfile_saver & );	// declared as private
+  void operator=( const Logfile_saver & );	// declared as private
+
+public:
+  Logfile_saver();
+  ~Logfile_saver();
+
+  bool ok() const { return ok_; }
+
+  bool save( const Logfile & logfile, const int odes );
+  bool wait();
+  void save_snapshots();			// run by the saver thread
+  };
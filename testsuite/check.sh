@@ -85,6 +85,12 @@ if [ $? = 1 ] ; then printf . ; else printf - ; fail=1 ; fi
 if [ $? = 1 ] ; then printf . ; else printf - ; fail=1 ; fi
 "${DDRESCUE}" -q --cpass=4 ${in} out
 if [ $? = 1 ] ; then printf . ; else printf - ; fail=1 ; fi
+"${DDRESCUE}" -q --io-engine=foo ${in} out
+if [ $? = 1 ] ; then printf . ; else printf - ; fail=1 ; fi
+"${DDRESCUE}" -q --io-engine=lseek --threads=2 ${in} out
+if [ $? = 1 ] ; then printf . ; else printf - ; fail=1 ; fi
+"${DDRESCUE}" -q --io-engine=lseek --pipeline ${in} out
+if [ $? = 1 ] ; then printf . ; else printf - ; fail=1 ; fi
 
 rm -f logfile
 "${DDRESCUE}" -q -t -p -i15000 ${in} out logfile || fail=1
@@ -92,6 +98,76 @@ rm -f logfile
 cmp ${in} out || fail=1
 printf .
 
+rm -f out copy			# sectors are counted with the final sector size
+"${DDRESCUE}" -q -i1s -s2s -b4096 ${in} out || fail=1
+"${DDRESCUE}" -q -i4096 -s8192 ${in} copy || fail=1
+cmp out copy || fail=1
+printf .
+
+zcopy=			# zero-copy may not be available on this system
+if "${DDRESCUE}" --zero-copy --help > /dev/null 2>&1 ; then zcopy=--zero-copy
+else printf "\nwarning: --zero-copy not available; its test will be skipped.\n"
+fi
+uring=			# io_uring may not be available on this system
+if "${DDRESCUE}" --io-uring --help > /dev/null 2>&1 ; then
+	uring="--io-uring --io-uring=2"
+else printf "\nwarning: --io-uring not available; its test will be skipped.\n"
+fi
+fail2=0			# test copying options that change the way data is written
+for opts in --io-engine=lseek "--io-engine=lseek -y -c1,16" \
+            --pipeline "--pipeline=2 -y" ${zcopy} ${uring} \
+            -c1,16 "-c1,16 --pipeline" --threads=3 "--threads=4 -y" \
+            "-y --group-commit=4096" "--group-commit=4096,10 --pipeline" \
+            --max-map-memory=4096 ; do
+	rm -f out logfile
+	"${DDRESCUE}" -q ${opts} -i15000 ${in} out logfile || fail2=1
+	"${DDRESCUE}" -q ${opts} -s15000 ${in} out logfile || fail2=1
+	cmp ${in} out || fail2=1
+	rm -f out logfile
+	"${DDRESCUE}" -q ${opts} -H ${logfile1} ${in} out logfile || fail2=1
+	cmp ${in1} out || fail2=1
+	rm -f logfile
+	"${DDRESCUE}" -q ${opts} -L -K0 -H ${logfile2i} ${in2} out logfile || fail2=1
+	cmp ${in} out || fail2=1
+done
+if [ ${fail2} = 0 ] ; then printf . ; else printf - ; fail=1 ; fi
+
+rm -f out logfile da		# test a fragmented map paged out to a swap file
+i=0
+while [ $i -lt 2300 ] ; do echo $i ; i=$(( $i + 2 )) ; done | \
+	"${DDRESCUELOG}" -b16 -s36388 -c+- da || framework_failure
+"${DDRESCUELOG}" -n da > db || framework_failure
+"${DDRESCUE}" -q --max-map-memory=1 -m da ${in} out logfile || fail=1
+"${DDRESCUELOG}" -P da logfile || fail=1
+"${DDRESCUE}" -q --max-map-memory=1 -m db ${in} out logfile || fail=1
+cmp ${in} out || fail=1
+"${DDRESCUELOG}" -d logfile || fail=1
+printf .
+
+rm -f out logfile sparse	# test an input file with holes
+dd if=${in} of=sparse bs=4096 seek=16 2> /dev/null || framework_failure
+dd if=${in} of=sparse bs=4096 seek=48 conv=notrunc 2> /dev/null || framework_failure
+dd if=/dev/null of=sparse bs=4096 seek=80 2> /dev/null || framework_failure
+fail2=0
+"${DDRESCUE}" -q sparse out logfile || fail2=1
+cmp sparse out || fail2=1
+"${DDRESCUELOG}" -d logfile || fail2=1
+rm -f out
+"${DDRESCUE}" -q -S sparse out || fail2=1
+cmp sparse out || fail2=1
+rm -f out
+"${DDRESCUE}" -q -S -i65536 -s36388 -o0 sparse out || fail2=1
+cmp ${in} out || fail2=1
+rm -f out
+"${DDRESCUE}" -q -S -i32768 -o0 sparse out || fail2=1
+dd if=sparse of=copy bs=4096 skip=8 2> /dev/null || framework_failure
+cmp copy out || fail2=1
+rm -f out
+"${DDRESCUE}" -q -o8192 sparse out || fail2=1
+dd if=sparse of=copy bs=4096 seek=2 2> /dev/null || framework_failure
+cmp copy out || fail2=1
+if [ ${fail2} = 0 ] ; then printf . ; else printf - ; fail=1 ; fi
+
 rm -f out
 rm -f logfile
 "${DDRESCUE}" -q -R -i15000 ${in} out logfile || fail=1
@@ -201,6 +277,38 @@ cat ${in2} > out || framework_failure
 cmp ${in} out || fail=1
 printf .
 
+rm -f out
+rm -f logfile
+"${DDRESCUE}" -q --journal -i15000 ${in} out logfile || fail=1
+"${DDRESCUE}" -q --journal -s15000 ${in} out logfile || fail=1
+cmp ${in} out || fail=1
+[ -f logfile.journal ] && fail=1
+"${DDRESCUELOG}" -d logfile || fail=1
+printf .
+
+cat ${logfile1} > logfile || framework_failure
+cat ${in1} > out || framework_failure
+printf "# Rescue Journal\n0x00000800  0x00008624  +\n0x00000000     +\n0x00000000  0x0000" > logfile.journal || framework_failure
+"${DDRESCUE}" -q --journal ${in2} out logfile || fail=1
+cmp ${in1} out || fail=1
+[ -f logfile.journal ] && fail=1
+"${DDRESCUELOG}" -d logfile || fail=1
+printf .
+
+rm -f out copy logfile		# test saving the logfile from a separate thread
+"${DDRESCUE}" -q -H ${logfile1} ${in} out copy || fail=1
+rm -f out
+"${DDRESCUE}" -q --async-logfile -H ${logfile1} ${in} out logfile || fail=1
+cmp ${in1} out || fail=1
+"${DDRESCUELOG}" -p copy logfile || fail=1
+rm -f out logfile
+"${DDRESCUE}" -q --async-logfile -i15000 ${in} out logfile || fail=1
+"${DDRESCUE}" -q --async-logfile -s15000 ${in} out logfile || fail=1
+cmp ${in} out || fail=1
+[ -f logfile.tmp ] && fail=1
+"${DDRESCUELOG}" -d logfile || fail=1
+printf .
+
 printf "\ntesting ddrescuelog-%s..." "$2"
 
 "${DDRESCUELOG}" -q logfile
@@ -247,6 +355,31 @@ if [ $? = 1 ] ; then printf . ; else printf - ; fail=1 ; fi
 "${DDRESCUELOG}" -i0x5000 -s0x3800 -p logfile ${logfile1} || fail=1
 printf .
 
+rm -f logfile
+printf "16\n3\n4\n3\n0\n9\n5\n4\n" | "${DDRESCUELOG}" -b2048 -c logfile || fail=1
+"${DDRESCUELOG}" -b2048 -l+ logfile > out || fail=1
+printf "0\n3\n4\n5\n9\n16\n" > copy || framework_failure
+cmp out copy || fail=1
+printf .
+rm -f logfile
+printf "7\n1\n7\n2\n1\n" | "${DDRESCUELOG}" -b2048 -s0x3000 -c+? logfile || fail=1
+grep -v '^#' logfile > out
+printf "0x00000000     ?\n0x00000000  0x00000800  ?\n0x00000800  0x00001000  +\n0x00001800  0x00001800  ?\n" > copy || framework_failure
+cmp out copy || fail=1
+printf .
+
+cat ${logfile1} > logfile || framework_failure
+printf "# Rescue Journal\n0x00000800  0x00000800  +\n0x00001800  0x00000800  +\n0x00002000     ?\n0x00002800  0x0000" > logfile.journal || framework_failure
+"${DDRESCUELOG}" -b2048 -l+ logfile > out || fail=1
+printf "0\n1\n2\n3\n4\n6\n8\n10\n12\n14\n16\n" > copy || framework_failure
+cmp out copy || fail=1
+[ -f logfile.journal ] || fail=1
+printf .
+printf "# Rescue Journal\n0x00000800  0x00000800  +\ngarbage\n0x00001800  0x00000800  +\n" > logfile.journal || framework_failure
+"${DDRESCUELOG}" -q -t logfile
+if [ $? = 2 ] ; then printf . ; else printf - ; fail=1 ; fi
+rm -f logfile.journal
+
 "${DDRESCUELOG}" -C ${logfile2i} > logfile || fail=1
 "${DDRESCUELOG}" -p ${logfile2} logfile || fail=1
 printf .
@@ -301,6 +434,15 @@ if [ $? = 2 ] ; then printf . ; else printf - ; fail=1 ; fi
 "${DDRESCUELOG}" -L -P ${logfile2i} ${logfile2} || fail=1
 printf .
 
+fail2=0			# test binary logfiles
+for i in ${logfile1} ${logfile2} ${logfile3} ${logfile4} ${logfile5} ; do
+	"${DDRESCUELOG}" --to-binary ${i} > out || fail2=1
+	"${DDRESCUELOG}" -p ${i} out || fail2=1
+	"${DDRESCUELOG}" --to-text out > copy || fail2=1
+	"${DDRESCUELOG}" -p ${i} copy || fail2=1
+done
+if [ ${fail2} = 0 ] ; then printf . ; else printf - ; fail=1 ; fi
+
 fail2=0			# test XOR
 for i in ${logfile1} ${logfile2} ${logfile3} ${logfile4} ${logfile5} ; do
 	for j in ${logfile1} ${logfile2} ${logfile3} ${logfile4} ${logfile5} ; do
@@ -492,6 +634,65 @@ fail2=0
 "${DDRESCUELOG}" -d logfile || fail2=1
 if [ ${fail2} = 0 ] ; then printf . ; else printf - ; fail=1 ; fi
 
+fail2=0			# test results of logic ops on logfiles of different extents
+printf "0x00000000     +\n0x00000000  0x00001000  +\n0x00001000  0x00001000  -\n0x00002000  0x00001000  ?\n" > la || framework_failure
+printf "0x00000000     ?\n0x00000800  0x00001000  +\n0x00001800  0x00001000  /\n0x00002800  0x00001800  +\n" > lb || framework_failure
+"${DDRESCUELOG}" -z lb la > logfile || fail2=1
+grep -v '^#' logfile > out
+printf "0x00000000     +\n0x00000000  0x00001800  +\n0x00001800  0x00000800  -\n0x00002000  0x00000800  ?\n0x00002800  0x00000800  +\n" > copy || framework_failure
+cmp out copy || fail2=1
+"${DDRESCUELOG}" -z la lb > logfile || fail2=1
+grep -v '^#' logfile > out
+cmp lb out || fail2=1
+"${DDRESCUELOG}" -y la lb > logfile || fail2=1
+grep -v '^#' logfile > out
+printf "0x00000000     ?\n0x00000800  0x00000800  +\n0x00001000  0x00000800  -\n0x00001800  0x00001000  /\n0x00002800  0x00000800  -\n0x00003000  0x00001000  +\n" > copy || framework_failure
+cmp out copy || fail2=1
+"${DDRESCUELOG}" -x lb la > logfile || fail2=1
+grep -v '^#' logfile > out
+printf "0x00000000     +\n0x00000000  0x00000800  +\n0x00000800  0x00000800  -\n0x00001000  0x00000800  +\n0x00001800  0x00000800  -\n0x00002000  0x00000800  ?\n0x00002800  0x00000800  +\n" > copy || framework_failure
+cmp out copy || fail2=1
+"${DDRESCUELOG}" -C lb > logfile || fail2=1
+grep -v '^#' logfile > out
+printf "0x00000000     ?\n0x00000000  0x00000800  ?\n0x00000800  0x00001000  +\n0x00001800  0x00001000  /\n0x00002800  0x00001800  +\n" > copy || framework_failure
+cmp out copy || fail2=1
+"${DDRESCUELOG}" -t lb > out || fail2=1
+printf "\n   current pos:         0 B,  current status: copying\nlogfile extent:     14336 B,  in      3 area(s)\n  domain begin:      2048 B,  domain end:     16384 B\n   domain size:     14336 B,  in      1 area(s)\n       rescued:     10240 B,  in      2 area(s)  ( 71.42%%)\n     non-tried:         0 B,  in      0 area(s)  (  0%%)\n   non-trimmed:         0 B,  in      0 area(s)  (  0%%)\n   non-scraped:      4096 B,  in      1 area(s)  ( 28.57%%)\n       errsize:         0 B,  errors:         0  (  0%%)\n" > copy || framework_failure
+cmp out copy || fail2=1
+"${DDRESCUELOG}" -q -p la lb && fail2=1
+"${DDRESCUELOG}" -q -P la lb && fail2=1
+"${DDRESCUELOG}" -i0x800 -s0x800 -p la lb || fail2=1
+"${DDRESCUELOG}" -i0x800 -s0x800 -P lb la || fail2=1
+printf "0x00000000     +\n0x00000000  0x00001000  +\n0x00001000  0x7FFFFFFFFFFFF000  -\n0xFFFFFFFFFFFFFFFFFFFF  0x00001000  +\n" > lc || framework_failure
+for i in "-t lc" "-p lc la" "-p la lc" "--merge la lc" "-C lc" ; do
+	"${DDRESCUELOG}" -q ${i} > /dev/null
+	[ $? = 2 ] || fail2=1
+done
+if [ ${fail2} = 0 ] ; then printf . ; else printf - ; fail=1 ; fi
+
+fail2=0			# test merge of three logfiles of different extents
+printf "0x00000000     ?\n0x00001800  0x00000800  *\n0x00002000  0x00000800  -\n0x00002800  0x00002800  +\n" > lc || framework_failure
+"${DDRESCUELOG}" --merge la lb lc > logfile || fail2=1
+grep -v '^#' logfile > out
+printf "0x00000000     +\n0x00000000  0x00001800  +\n0x00001800  0x00000800  -\n0x00002000  0x00000800  ?\n0x00002800  0x00000800  +\n" > copy || framework_failure
+cmp out copy || fail2=1
+"${DDRESCUELOG}" -z lb la > out || fail2=1
+"${DDRESCUELOG}" -z lc out > copy || fail2=1
+"${DDRESCUELOG}" -p logfile copy || fail2=1
+"${DDRESCUELOG}" --merge=and la lb lc > logfile || fail2=1
+grep -v '^#' logfile > out
+printf "0x00000000     +\n0x00000000  0x00001000  +\n0x00001000  0x00001000  -\n0x00002000  0x00001000  ?\n" > copy || framework_failure
+cmp out copy || fail2=1
+"${DDRESCUELOG}" --merge=and lc lb la > logfile || fail2=1
+grep -v '^#' logfile > out
+printf "0x00000000     ?\n0x00001800  0x00000800  *\n0x00002000  0x00001000  -\n0x00003000  0x00002000  +\n" > copy || framework_failure
+cmp out copy || fail2=1
+"${DDRESCUELOG}" --merge=best la lb lc > logfile || fail2=1
+grep -v '^#' logfile > out
+printf "0x00000000     +\n0x00000000  0x00001800  +\n0x00001800  0x00001000  -\n0x00002800  0x00000800  +\n" > copy || framework_failure
+cmp out copy || fail2=1
+if [ ${fail2} = 0 ] ; then printf . ; else printf - ; fail=1 ; fi
+
 fail2=0			# test ( a && b ) == !( !a || !b )
 for i in ${logfile1} ${logfile2} ${logfile3} ${logfile4} ${logfile5} ; do
 	for j in ${logfile1} ${logfile2} ${logfile3} ${logfile4} ${logfile5} ; do
@@ -0,0 +1,276 @@
+/*  GNU ddrescue - Data recovery tool
+    Copyright (C) 2015 Antonio Diaz Diaz.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _FILE_OFFSET_BITS 64
+
+#include <cerrno>
+#include <cstring>
+#include <vector>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "uring.h"
+
+#if defined USE_NON_POSIX && defined __linux__ && defined __has_include
+#if __has_include( <linux/io_uring.h> )
+#include <sys/syscall.h>
+#if defined __NR_io_uring_setup && defined __NR_io_uring_enter
+#define HAVE_IO_URING
+#endif
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+namespace {
+
+int uring_enter( const int fd, const unsigned to_submit,
+                 const unsigned min_complete, const unsigned flags )
+  {
+  return syscall( __NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                  (void *)0, 0 );
+  }
+
+} // end namespace
+
+
+struct Uring_reader::Ring
+  {
+  int fd;
+  unsigned * sq_tail, * sq_array, sq_mask;
+  unsigned * cq_head, * cq_tail, cq_mask;
+  io_uring_sqe * sqes;
+  io_uring_cqe * cqes;
+  void * sq_ptr, * cq_ptr;
+  size_t sq_len, cq_len, sqes_len;
+  std::vector< struct iovec > iovecs;	// one per slot
+
+  explicit Ring( const unsigned entries );
+  ~Ring();
+  bool ok() const { return fd >= 0; }
+  bool submit( const int slot, const int ifd, uint8_t * const buf,
+               const int size, const long long pos );
+  };
+
+
+Uring_reader::Ring::Ring( const unsigned entries )
+  : fd( -1 ), sq_ptr( MAP_FAILED ), cq_ptr( MAP_FAILED ), sq_len( 0 ),
+    cq_len( 0 ), sqes_len( 0 ), iovecs( entries )
+  {
+  struct io_uring_params p;
+  std::memset( &p, 0, sizeof p );
+  const int rfd = syscall( __NR_io_uring_setup, entries, &p );
+  if( rfd < 0 ) return;
+  sq_len = p.sq_off.array + p.sq_entries * sizeof (unsigned);
+  cq_len = p.cq_off.cqes + p.cq_entries * sizeof (io_uring_cqe);
+  sqes_len = p.sq_entries * sizeof (io_uring_sqe);
+  sq_ptr = mmap( 0, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                 rfd, IORING_OFF_SQ_RING );
+  cq_ptr = mmap( 0, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                 rfd, IORING_OFF_CQ_RING );
+  void * const sqes_ptr = mmap( 0, sqes_len, PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_POPULATE, rfd, IORING_OFF_SQES );
+  if( sq_ptr == MAP_FAILED || cq_ptr == MAP_FAILED || sqes_ptr == MAP_FAILED )
+    {
+    if( sqes_ptr != MAP_FAILED ) munmap( sqes_ptr, sqes_len );
+    close( rfd ); return;
+    }
+  uint8_t * const sq = (uint8_t *)sq_ptr;
+  uint8_t * const cq = (uint8_t *)cq_ptr;
+  sq_tail = (unsigned *)( sq + p.sq_off.tail );
+  sq_array = (unsigned *)( sq + p.sq_off.array );
+  sq_mask = *(unsigned *)( sq + p.sq_off.ring_mask );
+  cq_head = (unsigned *)( cq + p.cq_off.head );
+  cq_tail = (unsigned *)( cq + p.cq_off.tail );
+  cq_mask = *(unsigned *)( cq + p.cq_off.ring_mask );
+  sqes = (io_uring_sqe *)sqes_ptr;
+  cqes = (io_uring_cqe *)( cq + p.cq_off.cqes );
+  fd = rfd;
+  }
+
+
+Uring_reader::Ring::~Ring()
+  {
+  if( fd < 0 )
+    {
+    if( sq_ptr != MAP_FAILED ) munmap( sq_ptr, sq_len );
+    if( cq_ptr != MAP_FAILED ) munmap( cq_ptr, cq_len );
+    return;
+    }
+  munmap( sqes, sqes_len );
+  munmap( cq_ptr, cq_len );
+  munmap( sq_ptr, sq_len );
+  close( fd );
+  }
+
+
+bool Uring_reader::Ring::submit( const int slot, const int ifd,
+                                 uint8_t * const buf, const int size,
+                                 const long long pos )
+  {
+  const unsigned tail = *sq_tail;	// only written by us
+  const unsigned i = tail & sq_mask;
+  io_uring_sqe & sqe = sqes[i];
+  std::memset( &sqe, 0, sizeof sqe );
+  iovecs[slot].iov_base = buf;
+  iovecs[slot].iov_len = size;
+  sqe.opcode = IORING_OP_READV;
+  sqe.fd = ifd;
+  sqe.off = pos;
+  sqe.addr = (unsigned long)&iovecs[slot];
+  sqe.len = 1;
+  sqe.user_data = slot;
+  sq_array[i] = i;
+  __atomic_store_n( sq_tail, tail + 1, __ATOMIC_RELEASE );
+  int n;
+  do n = uring_enter( fd, 1, 0, 0 ); while( n < 0 && errno == EINTR );
+  if( n == 1 ) return true;
+  __atomic_store_n( sq_tail, tail, __ATOMIC_RELEASE );	// not consumed
+  return false;
+  }
+
+
+// Mark as done the requests already completed. If 'wait' is true, wait
+// until at least one more request is completed.
+//
+bool Uring_reader::reap_completions( const bool wait )
+  {
+  while( true )
+    {
+    unsigned h = *ring->cq_head;
+    const unsigned t = __atomic_load_n( ring->cq_tail, __ATOMIC_ACQUIRE );
+    if( h != t )
+      {
+      for( ; h != t; ++h )
+        {
+        const io_uring_cqe & cqe = ring->cqes[h & ring->cq_mask];
+        Slot & s = slots[cqe.user_data];
+        s.result = cqe.res; s.done = true;
+        }
+      __atomic_store_n( ring->cq_head, h, __ATOMIC_RELEASE );
+      return true;
+      }
+    if( !wait ) return true;
+    if( uring_enter( ring->fd, 0, 1, IORING_ENTER_GETEVENTS ) < 0 &&
+        errno != EINTR ) return false;
+    }
+  }
+
+
+bool Uring_reader::available() { return true; }
+
+#else	// HAVE_IO_URING
+
+struct Uring_reader::Ring
+  {
+  explicit Ring( const unsigned ) {}
+  bool ok() const { return false; }
+  bool submit( const int, const int, uint8_t * const, const int,
+               const long long ) { return false; }
+  };
+
+bool Uring_reader::reap_completions( const bool wait )
+  { if( wait ) { errno = ENOSYS; return false; } return true; }
+
+bool Uring_reader::available() { return false; }
+
+#endif	// HAVE_IO_URING
+
+
+Uring_reader::Uring_reader( const int depth, const int bufsize,
+                            const int alignment )
+  : ring( 0 ), buf_base( 0 ), head( 0 ), pending_( 0 ), failed( false )
+  {
+  if( depth <= 0 || bufsize <= 0 ) return;
+  ring = new Ring( depth );
+  if( !ring->ok() ) { delete ring; ring = 0; return; }
+  int stride = bufsize;			// keep every buffer aligned
+  if( alignment > 1 && stride % alignment )
+    stride += alignment - ( stride % alignment );
+  buf_base = new uint8_t[ (long)depth * stride + alignment ];
+  uint8_t * p = buf_base;
+  if( alignment > 1 )
+    {
+    const int disp = alignment - ( reinterpret_cast<long> (p) % alignment );
+    if( disp > 0 && disp < alignment ) p += disp;
+    }
+  slots.resize( depth );
+  for( int i = 0; i < depth; ++i, p += stride )
+    { slots[i].buf = p; slots[i].pos = -1; slots[i].fd = -1;
+      slots[i].size = 0; slots[i].result = 0; slots[i].done = true; }
+  }
+
+
+Uring_reader::~Uring_reader()
+  {
+  bool in_flight = false;		// wait for the reads still running
+  for( unsigned i = 0; i < slots.size() && !in_flight; ++i )
+    while( !slots[i].done )
+      if( !reap_completions( true ) ) { in_flight = true; break; }
+  delete ring;
+  if( !in_flight ) delete[] buf_base;	// else the kernel may still write it
+  }
+
+
+// Returns false if the request can't be queued, for example because the
+// next slot is still in use by a discarded request not yet completed.
+//
+bool Uring_reader::push( const int fd, const long long pos, const int size )
+  {
+  if( !ring || failed || full() || size <= 0 ) return false;
+  const int i = ( head + pending_ ) % slots.size();
+  Slot & s = slots[i];
+  if( !s.done && ( !reap_completions( false ) || !s.done ) ) return false;
+  s.pos = pos; s.fd = fd; s.size = size; s.result = 0; s.done = false;
+  if( !ring->submit( i, fd, s.buf, size, pos ) ) { s.done = true; return false; }
+  ++pending_;
+  return true;
+  }
+
+
+// If the oldest request in queue reads 'size' bytes at 'pos' from 'fd',
+// waits for its completion, removes it from queue, sets 'result' to the
+// number of bytes read (or -errno), and returns its buffer.
+// Else returns 0 and leaves the queue untouched.
+// The buffer returned is valid until the next call to 'push'.
+//
+uint8_t * Uring_reader::pop( const int fd, const long long pos,
+                             const int size, int & result )
+  {
+  if( !front_is( fd, pos, size ) ) return 0;
+  Slot & s = slots[head];
+  while( !s.done )
+    if( !reap_completions( true ) )	// can't wait. Stop using the queue
+      { failed = true; clear(); return 0; }
+  head = ( head + 1 ) % slots.size(); --pending_;
+  result = s.result;
+  return s.buf;
+  }
+
+
+// Discard all queued requests without waiting for them to complete.
+// The slots of the requests still running are not reused until their
+// completions arrive.
+//
+void Uring_reader::clear()
+  {
+  if( slots.size() ) head = ( head + pending_ ) % slots.size();
+  pending_ = 0;
+  }
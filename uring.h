@@ -0,0 +1,64 @@
+/*  GNU ddrescue - Data recovery tool
+    Copyright (C) 2015 Antonio Diaz Diaz.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Queue of asynchronous reads submitted through the linux io_uring
+// interface. Requests are completed in the same order they are queued.
+// Discarded requests keep their buffers until the kernel completes them.
+//
+class Uring_reader
+  {
+  struct Ring;				// kernel rings, defined in uring.cc
+  struct Slot
+    {
+    uint8_t * buf;
+    long long pos;
+    int fd, size;
+    int result;				// bytes read, or -errno
+    bool done;
+    };
+
+  Ring * ring;
+  uint8_t * buf_base;
+  std::vector< Slot > slots;		// circular queue of read requests
+  int head;				// index of oldest request
+  int pending_;				// requests in queue
+  bool failed;				// can't wait for completions
+
+  Uring_reader( const Uring_reader & );	// declared as private
+  void operator=( const Uring_reader & );	// declared as private
+
+  bool reap_completions( const bool wait );
+
+public:
+  Uring_reader( const int depth, const int bufsize, const int alignment );
+  ~Uring_reader();
+
+  bool ok() const { return ring != 0; }
+  int pending() const { return pending_; }
+  bool full() const { return pending_ >= (int)slots.size(); }
+  bool front_is( const int fd, const long long pos, const int size ) const
+    { if( pending_ <= 0 ) return false;
+      const Slot & s = slots[head];
+      return ( s.fd == fd && s.pos == pos && s.size == size ); }
+
+  bool push( const int fd, const long long pos, const int size );
+  uint8_t * pop( const int fd, const long long pos, const int size,
+                 int & result );
+  void clear();
+
+  static bool available();
+  };
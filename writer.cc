@@ -0,0 +1,178 @@
+/*  GNU ddrescue - Data recovery tool
+    Copyright (C) 2015 Antonio Diaz Diaz.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _FILE_OFFSET_BITS 64
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "block.h"
+#include "ddrescue.h"
+#include "io_backend.h"
+#include "writer.h"
+
+
+namespace {
+
+extern "C" void * writer_thread( void * arg )
+  {
+  static_cast< Block_writer * >( arg )->write_requests();
+  return 0;
+  }
+
+} // end namespace
+
+
+Block_writer::Block_writer( const int odes, const long long offset,
+                            const bool synchronous, const int buffers,
+                            const int bufsize, const int alignment )
+  : offset_( offset ), odes_( odes ), synchronous_( synchronous ),
+    buf_base( 0 ), requests( std::max( buffers, 1 ) ),
+    pushed( 0 ), written( 0 ), popped( 0 ), stop( false ), ok_( false )
+  {
+  int stride = bufsize;			// keep every buffer aligned
+  if( alignment > 1 && stride % alignment )
+    stride += alignment - ( stride % alignment );
+  buf_base = new uint8_t[ (long)requests.size() * stride + alignment ];
+  uint8_t * p = buf_base;
+  if( alignment > 1 )
+    {
+    const int disp = alignment - ( reinterpret_cast<long> (p) % alignment );
+    if( disp > 0 && disp < alignment ) p += disp;
+    }
+  for( unsigned i = 0; i < requests.size(); ++i, p += stride )
+    { requests[i].buf = p; requests[i].pos = -1;
+      requests[i].size = 0; requests[i].error = 0; }
+  pthread_mutex_init( &mutex, 0 );
+  pthread_cond_init( &work_cond, 0 );
+  pthread_cond_init( &done_cond, 0 );
+  ok_ = ( pthread_create( &thread, 0, writer_thread, this ) == 0 );
+  }
+
+
+// Finishes the requests still in queue before stopping the thread.
+//
+Block_writer::~Block_writer()
+  {
+  if( ok_ )
+    {
+    pthread_mutex_lock( &mutex );
+    stop = true;
+    pthread_cond_signal( &work_cond );
+    pthread_mutex_unlock( &mutex );
+    pthread_join( thread, 0 );
+    }
+  pthread_cond_destroy( &done_cond );
+  pthread_cond_destroy( &work_cond );
+  pthread_mutex_destroy( &mutex );
+  delete[] buf_base;
+  }
+
+
+// Queue the data in buffer() to be written at 'pos + offset'.
+//
+void Block_writer::push( const long long pos, const int size )
+  {
+  if( full() ) internal_error( "write queue overflow." );
+  Request & r = requests[pushed % requests.size()];
+  r.pos = pos; r.size = size; r.error = 0;
+  pthread_mutex_lock( &mutex );
+  ++pushed;
+  pthread_cond_signal( &work_cond );
+  pthread_mutex_unlock( &mutex );
+  }
+
+
+// Remove the oldest request from queue if it has been written, waiting
+// for it if 'wait' is true. Returns false if nothing was removed.
+// 'error' is set to the errno of the failed write, or to 0.
+//
+bool Block_writer::pop( long long & pos, int & size, int & error,
+                        const bool wait )
+  {
+  if( popped >= pushed ) return false;
+  pthread_mutex_lock( &mutex );
+  while( wait && written <= popped )
+    pthread_cond_wait( &done_cond, &mutex );
+  const bool done = ( written > popped );
+  pthread_mutex_unlock( &mutex );
+  if( !done ) return false;
+  const Request & r = requests[popped % requests.size()];
+  pos = r.pos; size = r.size; error = r.error;
+  ++popped;
+  return true;
+  }
+
+
+// Takes all the requests in queue as a batch. Each run of requests
+// contiguous in the output file is written with a single call to
+// writeblocks, and the output file is synced at most once per batch (see
+// Group_commit). The requests are marked as written only after the sync,
+// if one is due.
+//
+void Block_writer::write_requests()
+  {
+  std::vector< struct iovec > iov( requests.size() );
+  pthread_mutex_lock( &mutex );
+  while( true )
+    {
+    while( written >= pushed && !stop )
+      pthread_cond_wait( &work_cond, &mutex );
+    if( written >= pushed ) break;		// stop and queue empty
+    const unsigned long long end = pushed;	// end of batch
+    pthread_mutex_unlock( &mutex );
+    long long batch_size = 0;
+    for( unsigned long long i = written; i < end; )
+      {
+      const Request & r = requests[i % requests.size()];
+      unsigned long long j = i + 1;		// end of run
+      long long run_end = r.pos + r.size;
+      int count = 1, size = r.size;
+      iov[0].iov_base = r.buf; iov[0].iov_len = r.size;
+      for( ; j < end; ++j, ++count )
+        {
+        const Request & r2 = requests[j % requests.size()];
+        if( r2.pos != run_end || r2.size > INT_MAX / 2 - size ) break;
+        iov[count].iov_base = r2.buf; iov[count].iov_len = r2.size;
+        run_end += r2.size; size += r2.size;
+        }
+      int error = 0;
+      if( io_backend->writeblocks( odes_, &iov[0], count, r.pos + offset_ ) != size )
+        error = errno ? errno : EIO;
+      for( ; i < j; ++i ) requests[i % requests.size()].error = error;
+      batch_size += size;
+      }
+    if( synchronous_ && !commit.written( odes_, batch_size ) )
+      {
+      const int error = errno;
+      for( unsigned long long i = written; i < end; ++i )
+        if( requests[i % requests.size()].error == 0 )
+          requests[i % requests.size()].error = error;
+      }
+    pthread_mutex_lock( &mutex );
+    written = end;
+    pthread_cond_signal( &done_cond );
+    }
+  pthread_mutex_unlock( &mutex );
+  }
@@ -0,0 +1,65 @@
+/*  GNU ddrescue - Data recovery tool
+    Copyright (C) 2015 Antonio Diaz Diaz.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Ring of output buffers written to the output file by a separate
+// thread, so that the next read can proceed while the previous block is
+// being written. Requests are written and popped in the order they are
+// pushed.
+//
+class Block_writer
+  {
+  struct Request
+    {
+    uint8_t * buf;
+    long long pos;			// position in input file
+    int size;
+    int error;				// errno of the write, or 0
+    };
+
+  const long long offset_;		// outfile offset (opos - ipos)
+  const int odes_;			// output file descriptor
+  const bool synchronous_;
+  Group_commit commit;			// used by the writer thread
+  uint8_t * buf_base;
+  std::vector< Request > requests;	// circular queue of write requests
+  unsigned long long pushed, written, popped;	// request counters
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t work_cond;		// signals new request or stop
+  pthread_cond_t done_cond;		// signals request written
+  bool stop;
+  bool ok_;
+
+  Block_writer( const Block_writer & );	// declared as private
+  void operator=( const Block_writer & );	// declared as private
+
+public:
+  Block_writer( const int odes, const long long offset, const bool synchronous,
+                const int buffers, const int bufsize, const int alignment );
+  ~Block_writer();
+
+  bool ok() const { return ok_; }
+  int buffers() const { return requests.size(); }
+  int pending() const { return pushed - popped; }
+  bool full() const { return pending() >= buffers(); }
+  uint8_t * buffer() const			// buffer for next push
+    { return requests[pushed % requests.size()].buf; }
+
+  void push( const long long pos, const int size );
+  bool pop( long long & pos, int & size, int & error, const bool wait );
+  void write_requests();			// run by the writer thread
+  };
@@ -0,0 +1,132 @@
+/*  GNU ddrescue - Data recovery tool
+    Copyright (C) 2015 Antonio Diaz Diaz.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstring>
+#include <stdint.h>
+
+#include "zero.h"
+
+#if defined __GNUC__ && ( __GNUC__ >= 5 || defined __clang__ ) && \
+    ( defined __x86_64__ || defined __i386__ )
+#define ZERO_X86
+#include <immintrin.h>
+#endif
+
+
+namespace {
+
+bool zero_bytes( const uint8_t * const buf, const int size )
+  {
+  for( int i = 0; i < size; ++i ) if( buf[i] != 0 ) return false;
+  return true;
+  }
+
+
+// Tests one machine word at a time. memcpy avoids alignment and aliasing
+// problems, and is compiled to a plain load.
+//
+bool zero_words( const uint8_t * const buf, const int size )
+  {
+  enum { w = sizeof (unsigned long) };
+  int i = 0;
+  for( ; i + 4 * w <= size; i += 4 * w )
+    {
+    unsigned long a[4];
+    std::memcpy( a, buf + i, sizeof a );
+    if( a[0] | a[1] | a[2] | a[3] ) return false;
+    }
+  for( ; i + w <= size; i += w )
+    {
+    unsigned long a;
+    std::memcpy( &a, buf + i, sizeof a );
+    if( a ) return false;
+    }
+  for( ; i < size; ++i ) if( buf[i] != 0 ) return false;
+  return true;
+  }
+
+#ifdef ZERO_X86
+
+__attribute__(( target( "sse2" ) ))
+bool zero_sse2( const uint8_t * const buf, const int size )
+  {
+  int i = 0;
+  for( ; i + 64 <= size; i += 64 )
+    {
+    const __m128i * const p = (const __m128i *)( buf + i );
+    const __m128i v =
+      _mm_or_si128( _mm_or_si128( _mm_loadu_si128( p ), _mm_loadu_si128( p + 1 ) ),
+                    _mm_or_si128( _mm_loadu_si128( p + 2 ), _mm_loadu_si128( p + 3 ) ) );
+    if( _mm_movemask_epi8( _mm_cmpeq_epi8( v, _mm_setzero_si128() ) ) != 0xFFFF )
+      return false;
+    }
+  return zero_words( buf + i, size - i );
+  }
+
+
+__attribute__(( target( "avx2" ) ))
+bool zero_avx2( const uint8_t * const buf, const int size )
+  {
+  int i = 0;
+  for( ; i + 128 <= size; i += 128 )
+    {
+    const __m256i * const p = (const __m256i *)( buf + i );
+    const __m256i v =
+      _mm256_or_si256( _mm256_or_si256( _mm256_loadu_si256( p ),
+                                        _mm256_loadu_si256( p + 1 ) ),
+                       _mm256_or_si256( _mm256_loadu_si256( p + 2 ),
+                                        _mm256_loadu_si256( p + 3 ) ) );
+    if( !_mm256_testz_si256( v, v ) ) return false;
+    }
+  return zero_words( buf + i, size - i );
+  }
+
+#endif	// ZERO_X86
+
+
+Zero_test tests[5];
+
+
+// Fill 'tests' with the implementations supported by the cpu.
+// Returns the fastest one.
+//
+Zero_function * select_zero_test()
+  {
+  int n = 0;
+  tests[n].name = "bytes"; tests[n++].function = zero_bytes;
+  tests[n].name = "words"; tests[n++].function = zero_words;
+#ifdef ZERO_X86
+  __builtin_cpu_init();
+  if( __builtin_cpu_supports( "sse2" ) )
+    { tests[n].name = "sse2"; tests[n++].function = zero_sse2; }
+  if( __builtin_cpu_supports( "avx2" ) )
+    { tests[n].name = "avx2"; tests[n++].function = zero_avx2; }
+#endif
+  tests[n].name = 0; tests[n].function = 0;
+  return tests[n-1].function;
+  }
+
+Zero_function * const zero_function = select_zero_test();
+
+} // end namespace
+
+
+bool block_is_zero( const uint8_t * const buf, const int size )
+  { return zero_function( buf, size ); }
+
+
+const Zero_test * zero_tests() { return tests; }
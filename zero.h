@@ -0,0 +1,35 @@
+/*  GNU ddrescue - Data recovery tool
+    Copyright (C) 2015 Antonio Diaz Diaz.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Returns true if all the 'size' bytes in 'buf' are zero.
+// Uses the fastest implementation supported by the cpu.
+//
+bool block_is_zero( const uint8_t * const buf, const int size );
+
+
+typedef bool Zero_function( const uint8_t * const buf, const int size );
+
+struct Zero_test			// implementation of block_is_zero
+  {
+  const char * name;
+  Zero_function * function;
+  };
+
+// Returns the implementations usable on this cpu, from slowest to
+// fastest, terminated by an entry with name == 0.
+//
+const Zero_test * zero_tests();